@@ -1,7 +1,7 @@
 # Source files common to all architectures
 COMMON_SRCS = main.c \
-	mem.c malloc.c string.c \
-	thread.c synch.c workqueue.c \
+	mem.c malloc.c slab.c string.c \
+	thread.c synch.c workqueue.c smp.c \
 	dev.c blockdev.c range.c lba.c \
 	cons.c timer.c ramdisk.c \
 	vfs.c pfat.c \
@@ -23,6 +23,7 @@
 #include <geekos/types.h>
 #include <geekos/thread.h>
 #include <geekos/lba.h>
+#include <geekos/list.h>
 
 /* request type */
 typedef enum { BLOCKDEV_REQ_READ, BLOCKDEV_REQ_WRITE } blockdev_req_type_t;
@@ -32,19 +33,47 @@ typedef enum { BLOCKDEV_REQ_PENDING, BLOCKDEV_REQ_FINISHED } blockdev_req_state_
 
 struct blockdev;
 
+DECLARE_LIST(blockdev_req_list, blockdev_req);
+DECLARE_LIST(blockdev_fifo_list, blockdev_req);
+
+/*
+ * Completion callback for a block I/O request.
+ * May be called from interrupt context.
+ */
+typedef void (blockdev_req_callback_t)(struct blockdev_req *req);
+
+/*
+ * One piece of a (possibly discontiguous) request buffer.
+ */
+struct blockdev_seg {
+	void *buf;                     /* memory buffer */
+	size_t size;                   /* size of buffer in bytes */
+};
+
 /*
  * A request for block I/O.
+ * The data is transferred to/from the buffer segments
+ * in the segs array, in order.
  */
 struct blockdev_req {
 	lba_t lba;                     /* LBA of first block */
 	unsigned num_blocks;           /* number of blocks requested */
-	void *buf;                     /* memory buffer */
+	void *buf;                     /* memory buffer (first segment) */
+	struct blockdev_seg *segs;     /* buffer segments */
+	unsigned num_segs;             /* number of buffer segments */
+	struct blockdev_seg seg;       /* the only segment of a single-buffer request */
 	blockdev_req_type_t type;      /* request type */
 	blockdev_req_state_t state;    /* state of request */
 	int rc;                        /* return code (when request completes) */
 	struct thread_queue waitqueue; /* queue in which to wait for completion */
 	struct blockdev *dev;          /* the block device */
 	void *data;                    /* scratch pointer for use by driver */
+	blockdev_req_callback_t *callback; /* called on completion, if set */
+	void *callback_data;           /* private data for callback */
+	u32_t deadline;                /* tick by which the request should be dispatched */
+	u64_t post_cycles;             /* cycle count when the request was posted */
+	DEFINE_LINK(blockdev_req_list, blockdev_req);
+	DEFINE_LINK(blockdev_fifo_list, blockdev_req);
 };
 
 /*
@@ -57,27 +86,82 @@ struct blockdev_ops {
 	int (*close)(struct blockdev *dev);
 };
 
+/*
+ * Request queue statistics.
+ */
+struct blockdev_stats {
+	u32_t num_requests;            /* number of requests completed */
+	u32_t num_dispatched;          /* number of requests passed to the driver */
+	u32_t num_front_merges;        /* requests merged in front of another request */
+	u32_t num_back_merges;         /* requests merged after another request */
+	u32_t queue_depth;             /* number of requests queued or in progress */
+	u32_t max_queue_depth;         /* maximum value of queue_depth */
+	u64_t total_latency;           /* sum of request latencies (post to completion), in cycles */
+	u64_t max_latency;             /* maximum request latency, in cycles */
+};
+
+/* limits on the size of a merged request */
+#define BLOCKDEV_MAX_MERGE_SEGS   32
+#define BLOCKDEV_MAX_MERGE_BLOCKS 256
+
+/*
+ * Block device request queue.
+ * Requests are passed to the driver one at a time.
+ * Waiting requests are kept in LBA order, and are dispatched
+ * in elevator (C-LOOK) order unless the oldest one has
+ * passed its deadline.  Requests for contiguous ranges of blocks
+ * are merged into a single request when they are dispatched.
+ */
+struct blockdev_queue {
+	struct blockdev_req_list sorted;    /* waiting requests, in LBA order */
+	struct blockdev_fifo_list fifo;     /* waiting requests, in order posted */
+	struct blockdev_req *active;        /* request being processed by the driver */
+	bool dispatching;                   /* blockdev_queue_run() is passing requests to the driver */
+	struct blockdev_req_list merged;    /* requests making up merged_req */
+	struct blockdev_req merged_req;     /* merged request passed to the driver */
+	struct blockdev_seg merged_segs[BLOCKDEV_MAX_MERGE_SEGS];
+	lba_t next_lba;                     /* elevator position: end of last request dispatched */
+	struct blockdev_stats stats;
+};
+
 /*
  * Block device base class.
  */
 struct blockdev {
 	struct blockdev_ops *ops;
 	void *data; /* for use by driver */
+	struct blockdev_queue queue;
+	struct blockdev_req *req_cache;     /* preallocated requests */
+	struct blockdev_req_list free_reqs; /* unused requests in req_cache */
 };
 
 /* block device functions */
-struct blockdev_req *blockdev_create_request(lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type);
+struct blockdev *blockdev_create(struct blockdev_ops *ops, void *data);
+void blockdev_destroy(struct blockdev *dev);
+void blockdev_init_request(struct blockdev_req *req,
+	lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type);
+void blockdev_init_request_sg(struct blockdev_req *req, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs, blockdev_req_type_t type);
+struct blockdev_req *blockdev_alloc_request(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs, blockdev_req_type_t type);
+void blockdev_free_request(struct blockdev *dev, struct blockdev_req *req);
 void blockdev_post_request(struct blockdev *dev, struct blockdev_req *req);
 int blockdev_wait_for_completion(struct blockdev_req *req);
+int blockdev_wait_for_completion_timeout(struct blockdev_req *req, u64_t timeout_ns);
 int blockdev_post_and_wait(struct blockdev *dev, struct blockdev_req *req);
 void blockdev_notify_complete(struct blockdev_req *req, int rc);
 
 int blockdev_read_sync(struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf);
 int blockdev_write_sync(struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf);
+int blockdev_read_sync_sg(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs);
+int blockdev_write_sync_sg(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs);
 
 blocksize_t blockdev_get_block_size(struct blockdev *dev);
 ulong_t blockdev_get_num_blocks(struct blockdev *dev);
 int blockdev_close(struct blockdev *dev);
+void blockdev_get_stats(struct blockdev *dev, struct blockdev_stats *stats);
 
 #endif /* ifndef GEEKOS_BLOCKDEV_H */
 
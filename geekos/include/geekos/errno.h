@@ -29,6 +29,7 @@
 #define ENODEV -5      /* no such device */
 #define EIO -6         /* input/output error */
 #define ENOTSUP -7     /* operation not supported */
+#define ETIMEDOUT -8   /* timed out */
 
 #endif
 
@@ -36,16 +36,33 @@ typedef void (int_handler_t)(struct thread_context *tcontext);
 
 /* architecture-dependent functions */
 void int_init(void);
+void int_load_idt(void);
 void int_install_handler(int int_num, int_handler_t *handler);
 bool int_enabled(void);
 void int_enable__(void);
 void int_disable__(void);
+void int_wait__(void);
+
+/*
+ * On a multiprocessor, disabling interrupts also acquires the kernel
+ * lock, so code that used to rely on disabling interrupts for
+ * mutual exclusion remains correct.  See smp.c.
+ */
+void smp_lock_kernel(void);
+void smp_unlock_kernel(void);
 
 /* enable and disable interrupts (detecting improper nesting) */
 #define int_enable() \
-do { KASSERT(!int_enabled()); int_enable__(); } while (0)
+do { KASSERT(!int_enabled()); smp_unlock_kernel(); int_enable__(); } while (0)
 #define int_disable() \
-do { KASSERT(int_enabled()); int_disable__(); } while (0)
+do { KASSERT(int_enabled()); int_disable__(); smp_lock_kernel(); } while (0)
+
+/*
+ * enable interrupts and halt the CPU until an interrupt arrives;
+ * an interrupt cannot be delivered between the two steps
+ */
+#define int_wait() \
+do { KASSERT(!int_enabled()); int_wait__(); } while (0)
 
 /* Support for int-atomic regions */
 static __inline__ bool int_begin_atomic(void)
@@ -32,6 +32,7 @@ irq_mask_t irq_get_mask(void);
 void irq_set_mask(irq_mask_t mask);
 void irq_enable(int irq);
 void irq_disable(int irq);
+void irq_set_cpu(int irq, int cpu_id);
 void irq_begin(struct thread_context *context);
 void irq_end(struct thread_context *context);
 
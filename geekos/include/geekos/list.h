@@ -38,6 +38,7 @@ void list_type##_clear(struct list_type *list); \
 void list_type##_append(struct list_type *list, struct node_type *node); \
 void list_type##_append_all(struct list_type *list, struct list_type *to_append); \
 void list_type##_prepend(struct list_type *list, struct node_type *node); \
+void list_type##_insert_before(struct list_type *list, struct node_type *before, struct node_type *node); \
 struct node_type *list_type##_get_last(struct list_type *list); \
 struct node_type *list_type##_get_first(struct list_type *list); \
 struct node_type *list_type##_remove_last(struct list_type *list); \
@@ -114,6 +115,20 @@ void list_type##_prepend(struct list_type *list, struct node_type *node) \
 	} \
 }
 
+/* Define implementation of list_type##_insert_before function */
+#define IMPLEMENT_LIST_INSERT_BEFORE(list_type, node_type) \
+void list_type##_insert_before(struct list_type *list, struct node_type *before, struct node_type *node) \
+{ \
+	node->list_type##_next = before; \
+	node->list_type##_prev = before->list_type##_prev; \
+	if (before->list_type##_prev != 0) { \
+		before->list_type##_prev->list_type##_next = node; \
+	} else { \
+		list->head = node; \
+	} \
+	before->list_type##_prev = node; \
+}
+
 /* Define implementation of list_type##_get_last function */
 #define IMPLEMENT_LIST_GET_LAST(list_type, node_type) \
 struct node_type *list_type##_get_last(struct list_type *list) \
@@ -199,6 +214,7 @@ IMPLEMENT_LIST_CLEAR(list_type, node_type) \
 IMPLEMENT_LIST_APPEND(list_type, node_type) \
 IMPLEMENT_LIST_APPEND_ALL(list_type, node_type) \
 IMPLEMENT_LIST_PREPEND(list_type, node_type) \
+IMPLEMENT_LIST_INSERT_BEFORE(list_type, node_type) \
 IMPLEMENT_LIST_GET_LAST(list_type, node_type) \
 IMPLEMENT_LIST_GET_FIRST(list_type, node_type) \
 IMPLEMENT_LIST_REMOVE_LAST(list_type, node_type) \
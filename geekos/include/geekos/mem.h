@@ -37,10 +37,13 @@ typedef enum {
 	FRAME_HEAP,      /* frame is in kernel heap */
 	FRAME_KSTACK,    /* frame allocated as a thread's kernel stack */
 	FRAME_VM_PGCACHE,/* frame is allocated to a vm_pagecache */
+	FRAME_SLAB,      /* frame is a slab of a slab cache */
 } frame_state_t;
 
 DECLARE_LIST(frame_list, frame);
 
+struct vm_pagecache;
+
 /*
  * States describing the data stored in a frame.
  * These states are only applicable when the frame
@@ -60,20 +63,42 @@ struct frame {
 	frame_state_t state;
 	DEFINE_LINK(frame_list, frame);
 
+	struct vm_pagecache *vm_pgcache; /* vm_pagecache the frame belongs to */
 	u32_t vm_pgcache_page_num;    /* page number in vm_pagecache */
+	bool referenced;          /* page accessed since last visited by frame reclaim */
 	int refcount;             /* number of threads which have locked the frame */
 	page_content_t content;   /* status of frame contents (data) */
 	int errc;                 /* error code if content == PAGE_FAILED_INIT */
+
+	unsigned order;           /* order of the free block headed by this frame */
+	bool free_head;           /* true if frame heads a block on a buddy free list */
 };
 
+/*
+ * The largest block of contiguous frames that can be allocated
+ * with mem_alloc_frames() is 2^MEM_MAX_ORDER frames (4 MB).
+ */
+#define MEM_MAX_ORDER 10
+
 void mem_clear_bss(void);
 void mem_init(struct multiboot_info *boot_record);
 void *mem_alloc(size_t size);
+void *mem_alloc_nozero(size_t size);
 void mem_free(void *p);
 
 //void *mem_alloc_frame(void);
 struct frame *mem_alloc_frame(frame_state_t initial_state, int initial_refcount);
+struct frame *mem_try_alloc_frame(frame_state_t initial_state, int initial_refcount);
 void mem_free_frame(struct frame *frame);
+struct frame *mem_alloc_zeroed_frame(frame_state_t initial_state, int initial_refcount);
+bool mem_refill_zero_pool(void);
+struct frame *mem_alloc_frames(frame_state_t initial_state, int initial_refcount, unsigned order);
+void mem_free_frames(struct frame *frame, unsigned order);
+void mem_dump_frame_stats(void);
+void mem_buddy_benchmark(void);
+ulong_t mem_get_num_free_frames(void);
+ulong_t mem_get_heap_size(void);
+ulong_t mem_wait_for_reclaim(void);
 
 void *mem_frame_to_pa(struct frame *frm);
 struct frame *mem_pa_to_frame(void *pa);
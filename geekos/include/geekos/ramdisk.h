@@ -25,6 +25,17 @@
 
 struct blockdev;
 
+/*
+ * How a ramdisk services requests.
+ */
+typedef enum {
+	RAMDISK_MODE_WORKQUEUE, /* shared global workqueue thread (default) */
+	RAMDISK_MODE_INLINE,    /* synchronously, in the context of the thread posting the request */
+	RAMDISK_MODE_THREADS,   /* dedicated per-device service threads */
+} ramdisk_mode_t;
+
 struct blockdev *ramdisk_create(void *buf, size_t size);
+struct blockdev *ramdisk_create_mode(void *buf, size_t size, ramdisk_mode_t mode, unsigned num_threads);
+void ramdisk_benchmark(void);
 
 #endif /* ifndef GEEKOS_RAMDISK_H */
@@ -0,0 +1,72 @@
+/*
+ * GeekOS - slab allocator
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_SLAB_H
+#define GEEKOS_SLAB_H
+
+#include <stddef.h>
+#include <geekos/types.h>
+#include <geekos/list.h>
+
+/*
+ * A slab cache allocates fixed-size objects from page-sized
+ * slabs of memory obtained with mem_alloc_frame().
+ * Allocating and freeing an object takes constant time.
+ */
+
+DECLARE_LIST(slab_list, slab);
+DECLARE_LIST(slab_cache_list, slab_cache);
+
+struct slab_cache {
+	const char *name;
+	size_t obj_size;              /* object size, rounded up to SLAB_ALIGN */
+	unsigned objs_per_slab;       /* 0 until the cache is first used */
+	struct slab_list partial;     /* slabs with at least one free object */
+	unsigned num_slabs;           /* slabs allocated to the cache */
+	unsigned num_empty;           /* slabs with no objects in use */
+	unsigned num_used;            /* objects in use */
+
+	/* statistics */
+	ulong_t num_allocs;
+	ulong_t num_frees;
+	u32_t avg_alloc_cycles;       /* moving average */
+	u32_t max_alloc_cycles;
+
+	DEFINE_LINK(slab_cache_list, slab_cache);
+};
+
+/*
+ * Static initializer for a slab cache with given name
+ * and object size.  The cache is set up when it is first used.
+ */
+#define SLAB_CACHE_INITIALIZER(cache_name, size) \
+	{ .name = (cache_name), .obj_size = (size) }
+
+/* objects larger than this are allocated by malloc() rather than a size class */
+#define SLAB_MAX_SIZE 1024
+
+void *slab_alloc(struct slab_cache *cache);
+void *slab_alloc_nozero(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+struct slab_cache *slab_get_size_cache(size_t size);
+struct slab_cache *slab_get_cache(void *obj);
+void slab_dump_stats(void);
+void slab_benchmark(void);
+
+#endif /* GEEKOS_SLAB_H */
@@ -0,0 +1,70 @@
+/*
+ * GeekOS - symmetric multiprocessing
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_SMP_H
+#define GEEKOS_SMP_H
+
+/* maximum number of CPUs supported */
+#define CPU_MAX 8
+
+/* offsets of struct cpu fields used by assembly code (keep in sync with struct below) */
+#define CPU_SELF_OFFSET            0
+#define CPU_CURRENT_OFFSET         4
+#define CPU_NEED_RESCHEDULE_OFFSET 8
+
+#ifndef ASM
+
+#include <geekos/types.h>
+
+struct thread;
+
+/*
+ * Per-CPU data.
+ * Each CPU can find its own struct cpu in constant time
+ * (on x86, through the %gs segment), so fields that are only
+ * used by their own CPU need no locking.
+ */
+struct cpu {
+	struct cpu *self;               /* this struct (must be first) */
+	struct thread *current;         /* thread running on this CPU (must be second) */
+	volatile int need_reschedule;   /* set when a new thread should be chosen (must be third) */
+	int id;                         /* index in g_cpus */
+	int arch_id;                    /* hardware id (local APIC id on x86) */
+	volatile bool online;           /* set once the CPU is scheduling threads */
+	struct thread *idle_thread;     /* this CPU's idle thread */
+};
+
+extern struct cpu g_cpus[CPU_MAX];
+extern int g_num_cpus;
+
+#include <arch/smp.h>
+
+/* generic functions */
+void smp_init_cpus(void);
+void smp_activate_kernel_lock(void);
+
+/* architecture-dependent functions */
+void smp_init(void);
+void smp_start_cpus(void);
+int smp_num_cpus_present(void);
+void smp_send_reschedule(struct cpu *cpu);
+
+#endif /* ifndef ASM */
+
+#endif /* ifndef GEEKOS_SMP_H */
@@ -0,0 +1,63 @@
+/*
+ * GeekOS - spin locks
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_SPINLOCK_H
+#define GEEKOS_SPINLOCK_H
+
+#include <geekos/types.h>
+#include <arch/atomic.h>
+
+/*
+ * A spin lock provides mutual exclusion between CPUs.
+ * It must only be held with interrupts disabled, and only
+ * for short periods: other CPUs busy-wait while it is held.
+ */
+struct spinlock {
+	volatile u32_t locked;
+};
+
+#define SPINLOCK_INITIALIZER { 0 }
+
+static __inline__ void spin_lock_init(struct spinlock *lock)
+{
+	lock->locked = 0;
+}
+
+static __inline__ bool spin_trylock(struct spinlock *lock)
+{
+	return atomic_xchg(&lock->locked, 1) == 0;
+}
+
+static __inline__ void spin_lock(struct spinlock *lock)
+{
+	while (atomic_xchg(&lock->locked, 1) != 0) {
+		/* wait until lock looks free before trying again */
+		while (lock->locked) {
+			cpu_relax();
+		}
+	}
+}
+
+static __inline__ void spin_unlock(struct spinlock *lock)
+{
+	atomic_barrier();
+	lock->locked = 0;
+}
+
+#endif /* ifndef GEEKOS_SPINLOCK_H */
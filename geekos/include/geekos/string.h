@@ -30,6 +30,7 @@ size_t strnlen(const char *s, size_t maxlen);
 int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, size_t limit);
 char *strncpy(char *dest, const char *src, size_t limit);
+void string_benchmark(void);
 #if 0
 char *strdup(const char *s);
 #endif
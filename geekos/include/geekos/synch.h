@@ -23,28 +23,88 @@
 
 #include <geekos/thread.h>
 
-typedef enum { MUTEX_UNLOCKED = 0, MUTEX_LOCKED = 1 } mutex_state_t;
+/*
+ * Mutex states.  MUTEX_CONTENDED means locked, and threads may be
+ * waiting in the wait queue, so unlocking must wake one up.
+ */
+typedef enum { MUTEX_UNLOCKED = 0, MUTEX_LOCKED = 1, MUTEX_CONTENDED = 2 } mutex_state_t;
+
+/*
+ * Maximum number of times a thread checks a mutex held by a
+ * thread running on another CPU before giving up and waiting.
+ */
+#define MUTEX_SPIN_LIMIT 1000
 
 struct mutex {
-	mutex_state_t state;
-	struct thread *owner;
+	volatile u32_t state;           /* a mutex_state_t */
+	struct thread *volatile owner;
 	struct thread_queue waitqueue;
+
+	/* contention statistics */
+	u32_t num_acquired;             /* number of times mutex was acquired */
+	u32_t num_contended;            /* acquisitions that found it locked */
+	u32_t num_spun;                 /* contended acquisitions that didn't have to wait */
+	u64_t wait_cycles;              /* total cycles spent acquiring it when contended */
 };
 
 struct condition {
 	struct thread_queue waitqueue;
 };
 
+/*
+ * Reader-writer lock state bits.  The low bits count the readers
+ * holding the lock.  RWLOCK_WAITERS means threads may be waiting
+ * in the wait queue, so the last release must wake them up.
+ */
+#define RWLOCK_WRITER  0x80000000U
+#define RWLOCK_WAITERS 0x40000000U
+#define RWLOCK_READERS 0x3FFFFFFFU
+
+/*
+ * Reader-writer lock: any number of readers, or a single writer.
+ * Once a thread is waiting, new readers wait too, so a stream
+ * of readers can't starve a writer.
+ */
+struct rwlock {
+	volatile u32_t state;
+	struct thread *volatile writer;
+	struct thread_queue waitqueue;
+
+	/* contention statistics */
+	volatile u32_t num_read_acquired;   /* number of times read-locked */
+	volatile u32_t num_read_contended;  /* read acquisitions that had to wait */
+	u32_t num_write_acquired;           /* number of times write-locked */
+	u32_t num_write_contended;          /* write acquisitions that had to wait */
+	u64_t write_wait_cycles;            /* total cycles writers spent waiting */
+};
+
 void mutex_init(struct mutex *mutex);
 void mutex_lock(struct mutex *mutex);
+bool mutex_trylock(struct mutex *mutex);
 void mutex_unlock(struct mutex *mutex);
+void mutex_dump_stats(struct mutex *mutex, const char *name);
+
+void rwlock_init(struct rwlock *rwlock);
+void rwlock_read_lock(struct rwlock *rwlock);
+void rwlock_read_unlock(struct rwlock *rwlock);
+void rwlock_write_lock(struct rwlock *rwlock);
+void rwlock_write_unlock(struct rwlock *rwlock);
+void rwlock_dump_stats(struct rwlock *rwlock, const char *name);
 
 void cond_init(struct condition *cond);
 void cond_wait(struct condition *cond, struct mutex *mutex);
+int cond_timedwait(struct condition *cond, struct mutex *mutex, u64_t timeout_ns);
 void cond_signal(struct condition *cond);
 void cond_broadcast(struct condition *cond);
 
 #define MUTEX_IS_HELD(mutex) \
-	((mutex)->state == MUTEX_LOCKED && (mutex)->owner == g_current)
+	((mutex)->state != MUTEX_UNLOCKED && (mutex)->owner == g_current)
+
+/* a rwlock doesn't record its readers, only that there are some */
+#define RWLOCK_IS_READ_HELD(rwlock) \
+	(((rwlock)->state & RWLOCK_READERS) != 0)
+
+#define RWLOCK_IS_WRITE_HELD(rwlock) \
+	(((rwlock)->state & RWLOCK_WRITER) != 0 && (rwlock)->writer == g_current)
 
 #endif /* ifndef GEEKOS_SYNCH_H */
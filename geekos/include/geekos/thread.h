@@ -29,12 +29,14 @@
 #include <arch/thread.h>
 #include <geekos/types.h>
 #include <geekos/list.h>
+#include <geekos/smp.h>
 
 struct thread;
 struct thread_context;
 struct process;
 
 DECLARE_LIST(thread_queue, thread);
+DECLARE_LIST(thread_list, thread);
 
 /* thread states */
 typedef enum {
@@ -44,11 +46,25 @@ typedef enum {
 /* thread creation mode: "attached" means parent will wait for child to exit */
 typedef enum { THREAD_ATTACHED, THREAD_DETACHED } thread_mode_t;
 
+/*
+ * Thread priorities: lower numbers are more important.
+ * The idle thread is the only thread at THREAD_PRIORITY_IDLE.
+ */
+#define THREAD_NUM_PRIORITIES   8
+#define THREAD_PRIORITY_HIGH    1
+#define THREAD_PRIORITY_DEFAULT 3
+#define THREAD_PRIORITY_LOW     5
+#define THREAD_PRIORITY_IDLE    (THREAD_NUM_PRIORITIES - 1)
+
+/* CPU affinity mask allowing a thread to run on any CPU */
+#define THREAD_AFFINITY_ALL 0xFFFFFFFFUL
+
 /*
  * Kernel thread - the basic scheduling unit.
  */
 struct thread {
 	ulong_t stack_ptr;		/* saved stack pointer (this must be the first field!) */
+	volatile int preemption;        /* set to 1 when preemption is enabled (this must be the second field!) */
 	volatile u32_t num_ticks;       /* number of ticks thread has been running */
 	void *stack;                    /* kernel stack */
 	struct thread *parent;          /* parent thread */
@@ -56,13 +72,36 @@ struct thread {
 	thread_state_t state;           /* state of thread in lifecycle */
 	int exitcode;                   /* thread's exit code */
 	int refcount;                   /* num threads that will wait for this one */
+	int base_priority;              /* priority assigned to thread */
+	int priority;                   /* current (feedback-adjusted) priority */
+	int cpu;                        /* CPU whose run queue the thread uses */
+	u32_t affinity;                 /* bit mask of CPUs the thread may run on */
+	struct thread_queue *waiting_on; /* queue thread is waiting in, if any */
+	bool timed_out;                 /* set if a timed wait expired */
 	struct thread_queue waitqueue;  /* wait queue for thread lifecycle events */
 	DEFINE_LINK(thread_queue, thread);
+
+	/* scheduler statistics */
+	u32_t total_ticks;              /* total ticks thread has been running */
+	u64_t run_cycles;               /* total cycles thread has been running */
+	u64_t wait_cycles;              /* total cycles thread has spent in the run queue */
+	u64_t switch_cycles;            /* cycle count when thread was last switched in */
+	u64_t ready_cycles;             /* cycle count when thread last became ready */
+	u32_t num_switches;             /* number of times thread was switched in */
+	u32_t num_voluntary;            /* number of times thread yielded or blocked */
+	u32_t num_preempted;            /* number of times thread was preempted */
+	u32_t num_migrations;           /* number of times thread moved to another CPU */
+	DEFINE_LINK(thread_list, thread); /* list of all threads */
 };
 
-extern struct thread *g_current;       /* pointer to current thread */
-extern volatile int g_need_reschedule; /* set to 1 when a new thread should be chosen */
-extern volatile int g_preemption;      /* set to 1 when preemption is enabled */
+/*
+ * Per-CPU scheduler state.
+ * g_need_reschedule should only be accessed with interrupts disabled,
+ * since otherwise the thread could migrate to another CPU.
+ */
+#define g_current (cpu_current())                      /* pointer to current thread */
+#define g_need_reschedule (cpu_self()->need_reschedule) /* set to 1 when a new thread should be chosen */
+#define g_preemption (g_current->preemption)           /* set to 1 when preemption is enabled */
 
 /* Type of thread start functions */
 typedef void (thread_func_t)(ulong_t arg);
@@ -70,14 +109,29 @@ typedef void (thread_func_t)(ulong_t arg);
 /* Bootstrap main thread, initialize scheduler. */
 void thread_init(void);
 
+/* Start scheduling on an application processor. */
+struct thread *thread_create_idle(struct cpu *cpu);
+void thread_start_cpu(void) __attribute__((noreturn));
+
 /* Creating, running, destroying threads. */
 struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode_t mode);
+struct thread *thread_create_priority(thread_func_t *start_func, ulong_t arg, thread_mode_t mode, int priority);
+void thread_set_priority(struct thread *thread, int priority);
+int thread_get_priority(struct thread *thread);
+int thread_set_affinity(struct thread *thread, u32_t affinity);
+u32_t thread_get_affinity(struct thread *thread);
+void thread_boost_priorities(void);
+bool thread_is_idle(struct thread *thread);
+bool thread_has_runnable(void);
 void thread_exit(int exitcode) __attribute__((noreturn));
 int thread_join(struct thread *child);
 
 /* Thread synchronization primitives. */
 void thread_wait(struct thread_queue *queue);
+bool thread_wait_timeout(struct thread_queue *queue, u32_t num_ticks);
 void thread_park(struct thread_queue *queue);
+bool thread_park_timeout(struct thread_queue *queue, u32_t num_ticks);
+void thread_sleep(u64_t ns);
 void thread_wakeup(struct thread_queue *queue);
 void thread_wakeup_one(struct thread_queue *queue);
 void thread_wait_until(struct thread_queue *queue, bool (*pred)(struct thread *), struct thread *thread);
@@ -85,12 +139,16 @@ bool thread_refcount_is_zero(struct thread *thread);
 bool thread_not_running(struct thread *thread);
 void thread_yield(void);
 void thread_relinquish_cpu(void);
+void thread_preempt(void);
 struct thread *thread_next_runnable(void);
 void thread_make_runnable(struct thread *thread);
 
 /* Pick a thread to run and run it, leaving current thread runnable. */
 void thread_schedule(void);
 
+/* Print per-thread scheduler statistics. */
+void thread_dump_stats(void);
+
 /* Architecture-dependent functions. */
 void thread_switch_to(struct thread *thread);
 void thread_bootstrap(struct thread *thread, thread_func_t *start_func, ulong_t arg);
@@ -22,12 +22,76 @@
 #define GEEKOS_TIMER_H
 
 #include <geekos/types.h>
+#include <geekos/list.h>
+
+/* timer interrupt rate: may be set to between 100 and 1000 */
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+/* length of a tick in nanoseconds */
+#define TIMER_NS_PER_TICK (1000000000UL / TIMER_HZ)
+
+/* convert milliseconds to nanoseconds */
+#define TIMER_MS_TO_NS(ms) ((u64_t) (ms) * 1000000UL)
+
+/* convert milliseconds to ticks, rounding up */
+#define TIMER_MS_TO_TICKS(ms) ((((ms) * TIMER_HZ) + 999) / 1000)
+
+/* number of ticks in one quantum */
+#define TIMER_QUANTUM TIMER_MS_TO_TICKS(40)
+
+/* number of ticks between boosts of all runnable threads to their base priority */
+#define TIMER_BOOST_INTERVAL TIMER_MS_TO_TICKS(1000)
+
+/*
+ * Tickless mode: rather than interrupting on every tick, the timer
+ * is programmed to interrupt only when the next event is due
+ * (see timer_next_event()), or after TIMER_TICKLESS_MAX_TICKS.
+ * Comment out for a periodic tick.
+ */
+#define TIMER_TICKLESS
+
+/* longest interval between timer interrupts in tickless mode */
+#define TIMER_TICKLESS_MAX_TICKS TIMER_MS_TO_TICKS(50)
+
+/* returned by timer_next_event() when no tick needs to be processed */
+#define TIMER_NO_EVENT 0xFFFFFFFFUL
+
+/*
+ * A timer event calls a function from the timer interrupt handler
+ * (with interrupts disabled) once a given number of ticks has elapsed.
+ */
+typedef void (timer_func_t)(void *arg);
+
+DECLARE_LIST(timer_event_list, timer_event);
+
+struct timer_event {
+	u32_t expires;                  /* tick at which the event expires */
+	u32_t remaining;                /* ticks left to wait after that (for very long timeouts) */
+	timer_func_t *func;             /* function to call */
+	void *arg;                      /* argument to pass to function */
+	struct timer_event_list *slot;  /* timer wheel slot, null if not pending */
+	DEFINE_LINK(timer_event_list, timer_event);
+};
 
 /* generic functions */
-void timer_process_tick(void);
+void timer_process_ticks(u32_t num_ticks);
+void timer_process_cpu_ticks(u32_t num_ticks);
+u32_t timer_next_event(void);
+void timer_event_init(struct timer_event *event, timer_func_t *func, void *arg);
+void timer_event_add(struct timer_event *event, u32_t num_ticks);
+bool timer_event_cancel(struct timer_event *event);
+void timer_sleep(u32_t num_ticks);
+u32_t timer_get_idle_ticks(void);
 
 /* architecture-dependent functions */
 void timer_init(void);
+void timer_init_ap(void);
+u64_t timer_read_cycles(void);
+u64_t timer_get_ns(void);
+u32_t timer_ns_to_ticks(u64_t ns);
+void timer_rearm(void);
 
 /* global tick counter */
 extern volatile u32_t g_numticks;
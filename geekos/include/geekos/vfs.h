@@ -108,9 +108,8 @@ struct inode {
 	struct inode *mount;          /* if another fs_instance is mounted here, ptr to its root directory */
 	struct inode_list child_list; /* list of child files and directories */
 	DEFINE_LINK(inode_list, inode);/* link fields for inode_list */
-	int refcount;                 /* reference count */
-	bool busy;                    /* true if a lookup is in progress */
-	struct condition inode_cond;  /* condition to serialize lookups; must hold fs mutex */
+	volatile u32_t refcount;      /* reference count; changed atomically */
+	struct mutex lookup_mutex;    /* serializes lookups that add to child_list */
 	void *p;                      /* for use by filesystem driver */
 };
 
@@ -120,6 +119,7 @@ int vfs_mount(const char *path, const char *fs_driver_name, const char *init, co
 int vfs_get_root_dir(struct inode **p_dir);
 int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p_inode);
 void vfs_release_ref(struct inode *inode);
+void vfs_dump_lock_stats(void);
 
 int vfs_read(struct inode *inode, void *buf, size_t len);
 int vfs_write(struct inode *inode, void *buf, size_t len);
@@ -28,6 +28,8 @@
 struct multiboot_info;
 struct vm_pager_ops;
 
+DECLARE_LIST(vm_pagecache_list, vm_pagecache);
+
 /*
  * A data store from which
  * pages of data can be read and
@@ -38,15 +40,45 @@ struct vm_pager {
 	void *p; /* for use by underlying pager implementation */	
 };
 
+/*
+ * Callback invoked when an asynchronous pager operation completes.
+ * May be called from interrupt context.
+ */
+typedef void (vm_pager_callback_t)(void *data, int rc);
+
+/* maximum number of pages transferred by a single vectored pager operation */
+#define VM_PAGER_MAX_PAGES 16
+
 /*
  * Operations supported by vm_pager objects.
+ * The vectored operations transfer num_pages consecutive pages
+ * starting at page_num, one page to/from each buffer, as a single I/O.
  */
 struct vm_pager_ops {
 	int (*read_page)(struct vm_pager *pager, void *buf, u32_t page_num);
 	int (*write_page)(struct vm_pager *pager, void *buf, u32_t page_num);
-	/* Other ops? */
+
+	/* vectored operations (optional) */
+	int (*read_pages)(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages);
+	int (*write_pages)(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages);
+
+	/* start a vectored read without waiting for it to complete (optional);
+	 * the bufs array itself needn't remain valid after the call returns */
+	int (*read_pages_async)(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages,
+		vm_pager_callback_t *callback, void *data);
+
+	/* number of pages in the backing store (optional; size is unbounded if absent) */
+	u32_t (*get_num_pages)(struct vm_pager *pager);
 };
 
+/*
+ * Each node of a vm_pagecache's page index is one page
+ * of slots, indexed by VM_RADIX_SHIFT bits of the page number.
+ */
+#define VM_RADIX_SHIFT (PAGE_POWER - 2)
+#define VM_RADIX_SLOTS (1 << VM_RADIX_SHIFT)
+#define VM_RADIX_MASK  (VM_RADIX_SLOTS - 1)
+
 /*
  * A vm_pagecache is a data store that can be mapped into
  * a process address space.
@@ -57,7 +89,19 @@ struct vm_pagecache {
 	struct mutex lock;
 	struct condition cond;
 	struct frame_list pagelist; /* list of pages containing data from underlying data store */
+	void **radix_root;          /* radix tree indexing pagelist frames by page number */
+	unsigned radix_height;      /* number of levels in the radix tree (0 if empty) */
+	void **radix_spare;         /* spare radix tree nodes, chained through slot 0 */
+	unsigned radix_num_spare;   /* number of spare radix tree nodes */
+	int num_pins;               /* flusher references, protected by the pagecache list mutex */
+	u32_t num_readahead;        /* frames locked by readahead reads in progress */
+	u32_t num_pages;            /* number of frames in pagelist */
+	u32_t num_dirty;            /* number of PAGE_DIRTY frames in pagelist */
+	u32_t ra_prev_page;         /* most recently locked page */
+	u32_t ra_next_page;         /* first page past the readahead window */
+	u32_t ra_window;            /* readahead window size (0 if access is not sequential) */
 	struct vm_pager *pager;    /* the underlying data store */
+	DEFINE_LINK(vm_pagecache_list, vm_pagecache);
 };
 
 /*
@@ -69,14 +113,29 @@ void vm_init_paging(struct multiboot_info *boot_info);
  * vm_pager functions
  */
 int vm_pager_create(struct vm_pager_ops *ops, void *p, struct vm_pager **p_pager);
+u32_t vm_pager_get_num_pages(struct vm_pager *pager);
 int vm_pagein(struct vm_pager *pager, u32_t page_num, struct frame *frame);
 int vm_pageout(struct vm_pager *pager, u32_t page_num, struct frame *frame);
+int vm_pagein_pages(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames);
+int vm_pageout_pages(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames);
+int vm_pagein_pages_async(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames,
+	vm_pager_callback_t *callback, void *data);
 
 /*
  * vm_pagecache functions
  */
+void vm_pagecache_init(void);
 int vm_pagecache_create(struct vm_pager *pager, struct vm_pagecache **p_obj);
+void vm_pagecache_destroy(struct vm_pagecache *obj);
 int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame);
 int vm_unlock_page(struct vm_pagecache *obj, struct frame *frame);
+void vm_mark_page_dirty(struct vm_pagecache *obj, struct frame *frame);
+int vm_pagecache_sync(struct vm_pagecache *obj);
+void vm_dump_lock_stats(void);
+
+/*
+ * Benchmarks
+ */
+void vm_pagecache_benchmark(void);
 
 #endif /* GEEKOS_VM_H */
@@ -0,0 +1,72 @@
+/*
+ * GeekOS - atomic operations
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_ATOMIC_H
+#define ARCH_ATOMIC_H
+
+#include <geekos/types.h>
+
+/*
+ * Atomically store given value, returning the previous value.
+ * (xchg with a memory operand is implicitly locked.)
+ */
+static __inline__ u32_t atomic_xchg(volatile u32_t *p, u32_t value)
+{
+	__asm__ __volatile__ ("xchgl %0, %1" : "+r" (value), "+m" (*p) : : "memory");
+	return value;
+}
+
+/*
+ * Atomically store new value if the current value is old,
+ * returning the previous value.
+ */
+static __inline__ u32_t atomic_cmpxchg(volatile u32_t *p, u32_t old, u32_t new)
+{
+	u32_t prev;
+	__asm__ __volatile__ ("lock; cmpxchgl %2, %1" : "=a" (prev), "+m" (*p) : "r" (new), "0" (old) : "memory");
+	return prev;
+}
+
+/*
+ * Atomically add given value, returning the previous value.
+ */
+static __inline__ u32_t atomic_fetch_add(volatile u32_t *p, u32_t value)
+{
+	__asm__ __volatile__ ("lock; xaddl %0, %1" : "+r" (value), "+m" (*p) : : "memory");
+	return value;
+}
+
+/*
+ * Prevent the compiler from moving memory accesses across this point.
+ * (x86 doesn't reorder stores with other stores.)
+ */
+static __inline__ void atomic_barrier(void)
+{
+	__asm__ __volatile__ ("" : : : "memory");
+}
+
+/*
+ * Hint to the CPU that we are in a spin-wait loop.
+ */
+static __inline__ void cpu_relax(void)
+{
+	__asm__ __volatile__ ("pause" : : : "memory");
+}
+
+#endif /* ifndef ARCH_ATOMIC_H */
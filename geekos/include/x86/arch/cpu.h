@@ -194,6 +194,8 @@ void x86_init_int_gate(struct x86_interrupt_gate *gate, ulong_t addr, int dpl);
 
 /* initialize GDT */
 void x86_seg_init_gdt(void);
+void x86_seg_load_gdt_ap(int cpu_id);
+void x86_seg_get_gdtr(u16_t *limit_and_base);
 void x86_load_gdtr(u16_t *limit_and_base);
 
 /* initialize IDT */
@@ -235,6 +237,10 @@ bool x86_cpuid(struct x86_cpuid_info *cpuid_info);
 #define KERN_CS SELECTOR(1, SEL_GDT, 0)
 #define KERN_DS SELECTOR(2, SEL_GDT, 0)
 
+/* selectors for per-CPU data segments (loaded in %gs) */
+#define KERN_PERCPU_FIRST_INDEX 4
+#define KERN_PERCPU_SEL(cpu_id) SELECTOR(KERN_PERCPU_FIRST_INDEX + (cpu_id), SEL_GDT, 0)
+
 /*
  * Bits in eflags register.
  */
@@ -244,11 +250,16 @@ bool x86_cpuid(struct x86_cpuid_info *cpuid_info);
 /*
  * Bits in cr0 register.
  */
+#define CR0_PE        (1 << 0)     /* protected mode enable */
+#define CR0_MP        (1 << 1)     /* monitor coprocessor */
+#define CR0_EM        (1 << 2)     /* emulate x87 FPU */
 #define CR0_PG        (1 << 31)    /* enable paging */
 
 /*
  * Bits in cr4 register.
  */
 #define CR4_PSE        (1 << 4)    /* page size extensions */
+#define CR4_OSFXSR     (1 << 9)    /* OS supports fxsave/fxrstor (enables SSE) */
+#define CR4_OSXMMEXCPT (1 << 10)   /* OS handles SIMD floating point exceptions */
 
 #endif /* ARCH_CPU_H */
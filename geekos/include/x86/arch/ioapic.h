@@ -0,0 +1,34 @@
+/*
+ * GeekOS - x86 IO APIC
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_IOAPIC_H
+#define ARCH_IOAPIC_H
+
+#include <geekos/types.h>
+
+/* polarity and trigger mode of an IO APIC input */
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL      (1 << 15)
+
+void ioapic_init(ulong_t paddr);
+int ioapic_num_pins(void);
+void ioapic_route(int pin, int vector, u32_t mode, int apic_id);
+void ioapic_set_masked(int pin, bool masked);
+
+#endif /* ifndef ARCH_IOAPIC_H */
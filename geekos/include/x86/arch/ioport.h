@@ -15,6 +15,9 @@ void ioport_outb(u16_t port, u8_t value);
 void ioport_outw(u16_t port, u16_t value);
 void ioport_outl(u16_t port, u32_t value);
 
+void ioport_insw(u16_t port, void *buf, ulong_t count);
+void ioport_outsw(u16_t port, const void *buf, ulong_t count);
+
 void ioport_delay(void);
 
 #endif /* ARCH_IOPORT_H */
@@ -10,6 +10,6 @@
 #include <geekos/types.h>
 
 /* type of IRQ mask bitset */
-typedef u16_t irq_mask_t;
+typedef u32_t irq_mask_t;
 
 #endif /* ifndef ARCH_IRQ_H */
@@ -0,0 +1,47 @@
+/*
+ * GeekOS - x86 local APIC
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_LAPIC_H
+#define ARCH_LAPIC_H
+
+#include <geekos/types.h>
+
+/* default physical address of the local APIC registers */
+#define LAPIC_DEFAULT_ADDR 0xFEE00000UL
+
+/* interrupt vector of the local APIC timer */
+#define LAPIC_TIMER_VECTOR 57
+
+/* interrupt vector for spurious local APIC interrupts (low 4 bits must be set) */
+#define LAPIC_SPURIOUS_VECTOR 63
+
+void lapic_init(ulong_t paddr);
+void lapic_init_ap(void);
+bool lapic_present(void);
+int lapic_get_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(int apic_id, int vector);
+void lapic_send_ipi_others(int vector);
+void lapic_send_init(int apic_id);
+void lapic_send_startup(int apic_id, ulong_t start_paddr);
+void lapic_timer_start(u32_t count, bool periodic);
+void lapic_timer_stop(void);
+u32_t lapic_timer_read(void);
+
+#endif /* ifndef ARCH_LAPIC_H */
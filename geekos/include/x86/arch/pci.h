@@ -0,0 +1,51 @@
+/*
+ * GeekOS - PCI configuration space access
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_PCI_H
+#define ARCH_PCI_H
+
+#include <geekos/types.h>
+
+/*
+ * Location of a PCI function.
+ */
+struct pci_func {
+	unsigned bus, dev, func;
+};
+
+/* configuration space registers (byte offsets) */
+#define PCI_REG_ID        0x00 /* device id (high), vendor id (low) */
+#define PCI_REG_COMMAND   0x04 /* status (high), command (low) */
+#define PCI_REG_CLASS     0x08 /* class, subclass, prog if, revision */
+#define PCI_REG_HEADER    0x0C /* header type in bits 16..23 */
+#define PCI_REG_BAR(n)    (0x10 + (n)*4)
+
+/* bits of command register */
+#define PCI_COMMAND_IO         (1 << 0)
+#define PCI_COMMAND_BUS_MASTER (1 << 2)
+
+/* class codes */
+#define PCI_CLASS_STORAGE      0x01
+#define PCI_SUBCLASS_IDE       0x01
+
+u32_t pci_config_read(const struct pci_func *pf, unsigned reg);
+void pci_config_write(const struct pci_func *pf, unsigned reg, u32_t value);
+bool pci_find_class(unsigned class_code, unsigned subclass, struct pci_func *pf);
+
+#endif /* ARCH_PCI_H */
@@ -0,0 +1,68 @@
+/*
+ * GeekOS - x86 multiprocessor support
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_SMP_H
+#define ARCH_SMP_H
+
+/* interrupt vector of the reschedule inter-processor interrupt (above the IRQs) */
+#define SMP_RESCHEDULE_VECTOR 56
+
+/* physical address where application processors start (must be below 1M) */
+#define SMP_TRAMPOLINE_ADDR 0x1000
+
+#ifndef ASM
+
+struct thread_context;
+
+/*
+ * The %gs segment of each CPU is based at its struct cpu,
+ * so a single instruction finds the current thread even
+ * if the calling thread could migrate to another CPU.
+ */
+static __inline__ struct cpu *cpu_self(void)
+{
+	struct cpu *cpu;
+	__asm__ __volatile__ ("movl %%gs:%c1, %0" : "=r" (cpu) : "i" (CPU_SELF_OFFSET));
+	return cpu;
+}
+
+static __inline__ struct thread *cpu_current(void)
+{
+	struct thread *thread;
+	__asm__ __volatile__ ("movl %%gs:%c1, %0" : "=r" (thread) : "i" (CPU_CURRENT_OFFSET));
+	return thread;
+}
+
+static __inline__ void cpu_set_current(struct thread *thread)
+{
+	__asm__ __volatile__ ("movl %0, %%gs:%c1" : : "r" (thread), "i" (CPU_CURRENT_OFFSET) : "memory");
+}
+
+/* called on entry to and exit from interrupt handlers */
+void smp_int_enter(struct thread_context *context);
+void smp_int_exit(struct thread_context *context);
+
+/* IO APIC information from the MP configuration table */
+ulong_t smp_get_ioapic_addr(void);
+int smp_get_isa_irq_pin(int irq, u16_t *flags);
+bool smp_has_imcr(void);
+
+#endif /* ifndef ASM */
+
+#endif /* ifndef ARCH_SMP_H */
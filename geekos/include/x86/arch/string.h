@@ -0,0 +1,33 @@
+/*
+ * GeekOS - x86 string functions
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARCH_STRING_H
+#define ARCH_STRING_H
+
+/*
+ * memcpy() and memset() are implemented in x86_string.c,
+ * so the generic versions in string.c are not used.
+ */
+#define ARCH_HAVE_MEMCPY
+#define ARCH_HAVE_MEMSET
+
+struct x86_cpuid_info;
+void x86_string_init(struct x86_cpuid_info *cpuid_info);
+
+#endif /* ARCH_STRING_H */
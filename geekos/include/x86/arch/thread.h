@@ -17,6 +17,10 @@
   (must keep in sync with <geekos/thread.h> */
 #define THREAD_STACK_PTR_OFFSET	0
 
+/* offset of preemption field in thread struct
+  (must keep in sync with <geekos/thread.h> */
+#define THREAD_PREEMPTION_OFFSET	4
+
 /* size of thread_context (must keep in sync with struct below) */
 #define THREAD_CONTEXT_SIZE	64
 
@@ -39,9 +43,12 @@
 /*
  * Restore CPU registers when switching to a new thread or
  * returning to interrupted code.
+ * %gs is not restored: it always refers to the per-CPU data
+ * of the CPU we are running on, which may not be the CPU
+ * on which the registers were saved.
  */
 #define THREAD_RESTORE_REGISTERS \
-	popl	%gs ; \
+	addl	$4, %esp ; \
 	popl	%fs ; \
 	popl	%es ; \
 	popl	%ds ; \
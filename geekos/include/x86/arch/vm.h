@@ -91,4 +91,7 @@ typedef struct {
 	unsigned reserved             : 28;
 } faultcode_t;
 
+/* map memory-mapped device registers above the 2G kernel mapping */
+void x86_vm_map_io(ulong_t paddr);
+
 #endif /* ARCH_VM_H */
@@ -21,48 +21,396 @@
 #include <geekos/mem.h>
 #include <geekos/int.h>
 #include <geekos/errno.h>
+#include <geekos/timer.h>
+#include <geekos/slab.h>
+
+/*
+ * NOTES:
+ * - The request queue is shared with driver completion code,
+ *   which may run in interrupt context, so it is only accessed
+ *   with interrupts disabled.
+ */
+
+IMPLEMENT_LIST_IS_EMPTY(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_CLEAR(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_APPEND(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_APPEND_ALL(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_INSERT_BEFORE(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_GET_FIRST(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_REMOVE_FIRST(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_REMOVE(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_NEXT(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_PREV(blockdev_req_list, blockdev_req)
+IMPLEMENT_LIST_APPEND(blockdev_fifo_list, blockdev_req)
+IMPLEMENT_LIST_GET_FIRST(blockdev_fifo_list, blockdev_req)
+IMPLEMENT_LIST_REMOVE(blockdev_fifo_list, blockdev_req)
+
+/*
+ * Number of ticks a request may wait in the queue before it is
+ * dispatched ahead of requests in elevator order
+ * (0.5 seconds for reads and 5 seconds for writes).
+ */
+#define BLOCKDEV_READ_DEADLINE_TICKS  TIMER_MS_TO_TICKS(500)
+#define BLOCKDEV_WRITE_DEADLINE_TICKS TIMER_MS_TO_TICKS(5000)
+
+/* number of preallocated requests in each device's request cache */
+#define BLOCKDEV_NUM_CACHED_REQS 16
+
+/* requests not taken from a device's request cache */
+static struct slab_cache s_req_cache = SLAB_CACHE_INITIALIZER("blockdev_req", sizeof(struct blockdev_req));
 
 /* ------------------- private implementation ------------------- */
 
-static int blockdev_issue_sync(
-	struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type)
+/*
+ * Get the LBA just past the end of given request.
+ */
+static lba_t blockdev_req_end(struct blockdev_req *req)
+{
+	return lba_add_offset(req->lba, req->num_blocks);
+}
+
+/*
+ * Add a request to the queue, keeping the waiting requests in LBA order.
+ * Interrupts must be disabled.
+ */
+static void blockdev_queue_insert(struct blockdev_queue *q, struct blockdev_req *req)
 {
+	struct blockdev_req *pos;
+
+	KASSERT(!int_enabled());
+
+	for (pos = blockdev_req_list_get_first(&q->sorted);
+	     pos != 0 && lba_compare(pos->lba, req->lba) <= 0;
+	     pos = blockdev_req_list_next(pos)) {
+	}
+	if (pos != 0) {
+		blockdev_req_list_insert_before(&q->sorted, pos, req);
+	} else {
+		blockdev_req_list_append(&q->sorted, req);
+	}
+	blockdev_fifo_list_append(&q->fifo, req);
+
+	q->stats.queue_depth++;
+	if (q->stats.queue_depth > q->stats.max_queue_depth) {
+		q->stats.max_queue_depth = q->stats.queue_depth;
+	}
+}
+
+/*
+ * Check whether a waiting request can be merged with a request
+ * (or run of merged requests) of given type, block count,
+ * and segment count.
+ */
+static bool blockdev_queue_can_merge(struct blockdev_req *req,
+	blockdev_req_type_t type, unsigned num_blocks, unsigned num_segs)
+{
+	return req->type == type
+		&& num_blocks + req->num_blocks <= BLOCKDEV_MAX_MERGE_BLOCKS
+		&& num_segs + req->num_segs <= BLOCKDEV_MAX_MERGE_SEGS;
+}
+
+/*
+ * Choose the next request(s) to dispatch, and remove them from the queue.
+ * If several requests are merged, they are placed in q->merged,
+ * and q->merged_req describes the combined I/O.
+ * Returns the request to pass to the driver, or null if the queue is empty.
+ * Interrupts must be disabled.
+ */
+static struct blockdev_req *blockdev_queue_select(struct blockdev *dev, struct blockdev_queue *q)
+{
+	struct blockdev_req *first, *last, *req, *next;
+	unsigned num_blocks, num_segs, i;
+
+	KASSERT(!int_enabled());
+
+	first = blockdev_fifo_list_get_first(&q->fifo);
+	if (first == 0) {
+		return 0;
+	}
+
+	/*
+	 * Serve the oldest request if it has passed its deadline;
+	 * otherwise, continue the elevator sweep in increasing LBA order,
+	 * wrapping around to the lowest LBA at the end.
+	 */
+	if ((long) (g_numticks - first->deadline) < 0) {
+		for (first = blockdev_req_list_get_first(&q->sorted);
+		     first != 0 && lba_compare(first->lba, q->next_lba) < 0;
+		     first = blockdev_req_list_next(first)) {
+		}
+		if (first == 0) {
+			first = blockdev_req_list_get_first(&q->sorted);
+		}
+	}
+
+	num_blocks = first->num_blocks;
+	num_segs = first->num_segs;
+
+	/* front merges: earlier requests ending where the run starts */
+	last = first;
+	while ((req = blockdev_req_list_prev(first)) != 0
+	       && lba_compare(blockdev_req_end(req), first->lba) == 0
+	       && blockdev_queue_can_merge(req, first->type, num_blocks, num_segs)) {
+		num_blocks += req->num_blocks;
+		num_segs += req->num_segs;
+		first = req;
+		q->stats.num_front_merges++;
+	}
+
+	/* back merges: later requests starting where the run ends */
+	while ((req = blockdev_req_list_next(last)) != 0
+	       && lba_compare(blockdev_req_end(last), req->lba) == 0
+	       && blockdev_queue_can_merge(req, first->type, num_blocks, num_segs)) {
+		num_blocks += req->num_blocks;
+		num_segs += req->num_segs;
+		last = req;
+		q->stats.num_back_merges++;
+	}
+
+	q->next_lba = blockdev_req_end(last);
+	q->stats.num_dispatched++;
+
+	if (first == last) {
+		/* no merging: dispatch the request as is */
+		blockdev_req_list_remove(&q->sorted, first);
+		blockdev_fifo_list_remove(&q->fifo, first);
+		q->active = first;
+		return first;
+	}
+
+	/* build a single request covering the whole run */
+	req = &q->merged_req;
+	req->lba = first->lba;
+	req->num_blocks = num_blocks;
+	req->segs = q->merged_segs;
+	req->num_segs = 0;
+	req->type = first->type;
+	req->state = BLOCKDEV_REQ_PENDING;
+	req->rc = 0;
+	thread_queue_clear(&req->waitqueue);
+	req->dev = dev;
+	req->data = 0;
+	req->callback = 0;
+
+	blockdev_req_list_clear(&q->merged);
+	do {
+		next = (first == last) ? 0 : blockdev_req_list_next(first);
+		blockdev_req_list_remove(&q->sorted, first);
+		blockdev_fifo_list_remove(&q->fifo, first);
+		for (i = 0; i < first->num_segs; i++) {
+			q->merged_segs[req->num_segs++] = first->segs[i];
+		}
+		blockdev_req_list_append(&q->merged, first);
+		first = next;
+	} while (first != 0);
+
+	req->buf = req->segs[0].buf;
+
+	q->active = req;
+	return req;
+}
+
+/*
+ * Complete a request: wake up threads waiting for it,
+ * and invoke its callback.
+ */
+static void blockdev_finish_request(struct blockdev_queue *q, struct blockdev_req *req, int rc)
+{
+	blockdev_req_callback_t *callback = req->callback;
+	u64_t latency = timer_read_cycles() - req->post_cycles;
+	bool iflag = int_begin_atomic();
+	req->state = BLOCKDEV_REQ_FINISHED;
+	req->rc = rc;
+	thread_wakeup(&req->waitqueue);
+
+	q->stats.num_requests++;
+	q->stats.queue_depth--;
+	q->stats.total_latency += latency;
+	if (latency > q->stats.max_latency) {
+		q->stats.max_latency = latency;
+	}
+	int_end_atomic(iflag);
+
+	/* the callback may free the request, so don't touch it afterwards */
+	if (callback != 0) {
+		callback(req);
+	}
+}
+
+/*
+ * While the driver is idle, pass it the next request from the queue.
+ * A driver may complete a request from within its post_request
+ * operation, which calls back into this function: the nested call
+ * returns right away, and the outer call dispatches the next request.
+ * This keeps the stack depth constant however long the queue is.
+ */
+static void blockdev_queue_run(struct blockdev *dev)
+{
+	struct blockdev_queue *q = &dev->queue;
 	struct blockdev_req *req;
-	blockdev_req_state_t state;
+	bool iflag;
 
-	req = blockdev_create_request(lba, num_blocks, buf, type);
-	state = blockdev_post_and_wait(dev, req);
-	KASSERT(state == BLOCKDEV_REQ_FINISHED);
+	iflag = int_begin_atomic();
+	if (q->dispatching) {
+		int_end_atomic(iflag);
+		return;
+	}
+	q->dispatching = true;
 
-	mem_free(req);
+	for (;;) {
+		req = (q->active == 0) ? blockdev_queue_select(dev, q) : 0;
+		if (req == 0) {
+			break;
+		}
+		int_end_atomic(iflag);
 
-	return req->rc;
+		dev->ops->post_request(dev, req);
+
+		iflag = int_begin_atomic();
+	}
+
+	q->dispatching = false;
+	int_end_atomic(iflag);
 }
 
 /* ------------------- public interface ------------------- */
 
-struct blockdev_req *blockdev_create_request(lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type)
+/*
+ * Create a block device with given operations and driver data.
+ */
+struct blockdev *blockdev_create(struct blockdev_ops *ops, void *data)
 {
-	struct blockdev_req *req;
+	struct blockdev *dev;
+	unsigned i;
 
-	req = mem_alloc(sizeof(struct blockdev_req));
+	dev = mem_alloc(sizeof(struct blockdev));
+	dev->ops = ops;
+	dev->data = data;
+
+	/* mem_alloc() zero-fills, so the queue starts out empty */
+	dev->queue.next_lba = lba_from_num(0);
+
+	/* preallocate requests for blockdev_alloc_request() */
+	dev->req_cache = mem_alloc(BLOCKDEV_NUM_CACHED_REQS * sizeof(struct blockdev_req));
+	for (i = 0; i < BLOCKDEV_NUM_CACHED_REQS; i++) {
+		blockdev_req_list_append(&dev->free_reqs, &dev->req_cache[i]);
+	}
+
+	return dev;
+}
+
+/*
+ * Free a block device created by blockdev_create().
+ * Called by the driver's close operation, once no
+ * requests are outstanding.
+ */
+void blockdev_destroy(struct blockdev *dev)
+{
+	mem_free(dev->req_cache);
+	mem_free(dev);
+}
+
+/*
+ * Initialize a request whose memory is provided by the caller
+ * (e.g., on the stack).  The request must remain valid
+ * until it completes.
+ */
+void blockdev_init_request(struct blockdev_req *req,
+	lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type)
+{
 	req->lba = lba;
 	req->num_blocks = num_blocks;
 	req->buf = buf;
+	req->seg.buf = buf;
+	req->seg.size = 0; /* set when the request is posted */
+	req->segs = &req->seg;
+	req->num_segs = 1;
 	req->type = type;
 	req->state = BLOCKDEV_REQ_PENDING;
 	req->rc = 0;
 	thread_queue_clear(&req->waitqueue);
 	req->dev = 0;
 	req->data = 0;
+	req->callback = 0;
+	req->callback_data = 0;
+}
+
+/*
+ * Initialize a request that transfers data to/from a sequence
+ * of buffer segments.  The segment array must remain valid
+ * until the request completes.
+ */
+void blockdev_init_request_sg(struct blockdev_req *req, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs, blockdev_req_type_t type)
+{
+	KASSERT(num_segs > 0);
+
+	blockdev_init_request(req, lba, num_blocks, segs[0].buf, type);
+	req->segs = segs;
+	req->num_segs = num_segs;
+}
+
+/*
+ * Allocate a request from given device's request cache,
+ * falling back to the slab allocator if the cache is empty.
+ * The request is initialized as with blockdev_init_request_sg(),
+ * and must be freed with blockdev_free_request().
+ */
+struct blockdev_req *blockdev_alloc_request(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs, blockdev_req_type_t type)
+{
+	struct blockdev_req *req = 0;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+	if (!blockdev_req_list_is_empty(&dev->free_reqs)) {
+		req = blockdev_req_list_remove_first(&dev->free_reqs);
+	}
+	int_end_atomic(iflag);
+
+	if (req == 0) {
+		req = slab_alloc(&s_req_cache);
+	}
+	blockdev_init_request_sg(req, lba, num_blocks, segs, num_segs, type);
 
 	return req;
 }
 
+/*
+ * Free a request allocated by blockdev_alloc_request().
+ * May be called from interrupt context (e.g., by a completion callback).
+ */
+void blockdev_free_request(struct blockdev *dev, struct blockdev_req *req)
+{
+	bool iflag;
+
+	if (req >= dev->req_cache && req < dev->req_cache + BLOCKDEV_NUM_CACHED_REQS) {
+		iflag = int_begin_atomic();
+		blockdev_req_list_append(&dev->free_reqs, req);
+		int_end_atomic(iflag);
+	} else {
+		slab_free(&s_req_cache, req);
+	}
+}
+
 void blockdev_post_request(struct blockdev *dev, struct blockdev_req *req)
 {
+	bool iflag;
+
+	if (req->segs == &req->seg) {
+		/* now that the block size is known, so is the size of the buffer */
+		req->seg.size = lba_range_size_in_bytes(req->num_blocks, blockdev_get_block_size(dev));
+	}
 	req->dev = dev;
-	dev->ops->post_request(dev, req);
+	req->deadline = g_numticks + ((req->type == BLOCKDEV_REQ_READ)
+		? BLOCKDEV_READ_DEADLINE_TICKS : BLOCKDEV_WRITE_DEADLINE_TICKS);
+	req->post_cycles = timer_read_cycles();
+
+	iflag = int_begin_atomic();
+	blockdev_queue_insert(&dev->queue, req);
+	int_end_atomic(iflag);
+
+	blockdev_queue_run(dev);
 }
 
 int blockdev_wait_for_completion(struct blockdev_req *req)
@@ -75,29 +423,103 @@ int blockdev_wait_for_completion(struct blockdev_req *req)
 	return req->rc;
 }
 
+/*
+ * Wait for given request to complete, giving up after
+ * given number of nanoseconds.
+ * Returns the request's result code, or ETIMEDOUT if it is
+ * still pending (in which case the request still belongs
+ * to the device and must not be reused or freed).
+ */
+int blockdev_wait_for_completion_timeout(struct blockdev_req *req, u64_t timeout_ns)
+{
+	u32_t deadline = g_numticks + timer_ns_to_ticks(timeout_ns);
+	int rc;
+	bool iflag = int_begin_atomic();
+	while (req->state == BLOCKDEV_REQ_PENDING && (long) (deadline - g_numticks) > 0) {
+		thread_wait_timeout(&req->waitqueue, deadline - g_numticks);
+	}
+	rc = (req->state == BLOCKDEV_REQ_PENDING) ? ETIMEDOUT : req->rc;
+	int_end_atomic(iflag);
+	return rc;
+}
+
 int blockdev_post_and_wait(struct blockdev *dev, struct blockdev_req *req)
 {
 	blockdev_post_request(dev, req);
 	return blockdev_wait_for_completion(req);
 }
 
+/*
+ * Called by the driver when the request it was processing completes.
+ */
 void blockdev_notify_complete(struct blockdev_req *req, int rc)
 {
-	bool iflag = int_begin_atomic();
-	req->state = BLOCKDEV_REQ_FINISHED;
-	req->rc = rc;
-	thread_wakeup(&req->waitqueue);
+	struct blockdev *dev = req->dev;
+	struct blockdev_queue *q = &dev->queue;
+	struct blockdev_req_list merged;
+	bool iflag;
+
+	KASSERT(req == q->active);
+
+	if (req == &q->merged_req) {
+		/* complete each of the requests that were merged */
+		iflag = int_begin_atomic();
+		blockdev_req_list_clear(&merged);
+		blockdev_req_list_append_all(&merged, &q->merged);
+		int_end_atomic(iflag);
+
+		while (!blockdev_req_list_is_empty(&merged)) {
+			blockdev_finish_request(q, blockdev_req_list_remove_first(&merged), rc);
+		}
+	} else {
+		blockdev_finish_request(q, req, rc);
+	}
+
+	/* the driver is now idle: start the next request */
+	iflag = int_begin_atomic();
+	q->active = 0;
 	int_end_atomic(iflag);
+
+	blockdev_queue_run(dev);
 }
 
+/*
+ * The synchronous I/O functions use a request on the caller's stack,
+ * so they don't allocate any memory.
+ */
+
 int blockdev_read_sync(struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf)
 {
-	return blockdev_issue_sync(dev, lba, num_blocks, buf, BLOCKDEV_REQ_READ);
+	struct blockdev_req req;
+
+	blockdev_init_request(&req, lba, num_blocks, buf, BLOCKDEV_REQ_READ);
+	return blockdev_post_and_wait(dev, &req);
 }
 
 int blockdev_write_sync(struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf)
 {
-	return blockdev_issue_sync(dev, lba, num_blocks, buf, BLOCKDEV_REQ_WRITE);
+	struct blockdev_req req;
+
+	blockdev_init_request(&req, lba, num_blocks, buf, BLOCKDEV_REQ_WRITE);
+	return blockdev_post_and_wait(dev, &req);
+}
+
+int blockdev_read_sync_sg(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs)
+{
+	struct blockdev_req req;
+
+	blockdev_init_request_sg(&req, lba, num_blocks, segs, num_segs, BLOCKDEV_REQ_READ);
+	return blockdev_post_and_wait(dev, &req);
+}
+
+int blockdev_write_sync_sg(struct blockdev *dev, lba_t lba, unsigned num_blocks,
+	struct blockdev_seg *segs, unsigned num_segs)
+{
+	struct blockdev_req req;
+
+	blockdev_init_request_sg(&req, lba, num_blocks, segs, num_segs, BLOCKDEV_REQ_WRITE);
+	return blockdev_post_and_wait(dev, &req);
 }
 
 blocksize_t blockdev_get_block_size(struct blockdev *dev)
@@ -105,12 +527,26 @@ blocksize_t blockdev_get_block_size(struct blockdev *dev)
 	return dev->ops->get_block_size(dev);
 }
 
+/*
+ * Get a snapshot of a block device's request queue statistics.
+ */
+void blockdev_get_stats(struct blockdev *dev, struct blockdev_stats *stats)
+{
+	bool iflag = int_begin_atomic();
+	*stats = dev->queue.stats;
+	int_end_atomic(iflag);
+}
+
 int blockdev_close(struct blockdev *dev)
 {
 	if (dev == 0) {
 		return 0;
 	}
 
+	if (dev->ops->close == 0) {
+		return ENOTSUP;
+	}
+
 	return dev->ops->close(dev);
 }
 
@@ -35,19 +35,25 @@ struct blockdev_pager {
 	unsigned num_blocks_per_page;
 };
 
-typedef int (blockdev_rw_op)(struct blockdev *dev, lba_t lba, unsigned num_blocks, void *buf);
+/*
+ * State of an asynchronous page read.
+ */
+struct blockdev_pager_io {
+	vm_pager_callback_t *callback;
+	void *data;
+	struct blockdev_seg segs[VM_PAGER_MAX_PAGES];
+};
 
-static int blockdev_pager_rw_page(struct vm_pager *pager, void *buf, u32_t page_num,
-	blockdev_rw_op *rw_func)
+/*
+ * Compute the range of blocks to read or write for given page.
+ */
+static void blockdev_pager_get_io_range(struct blockdev_pager *blkdev_pager, u32_t page_num,
+	lba_t *p_start_lba, unsigned *p_num_blocks)
 {
-	int rc;
-	struct blockdev_pager *blkdev_pager;
 	lba_t io_start_lba;   /* io start LBA, inclusive */
 	lba_t io_end_lba;     /* io end LBA, exclusive */
 	lba_t range_end_lba;  /* last LBA in range covered by this blockdev_pager, exclusive */
 
-	blkdev_pager = pager->p;
-
 	io_start_lba = lba_add_offset(blkdev_pager->start, page_num * blkdev_pager->num_blocks_per_page);
 	io_end_lba = lba_add_offset(io_start_lba, blkdev_pager->num_blocks_per_page);
 
@@ -63,25 +69,162 @@ static int blockdev_pager_rw_page(struct vm_pager *pager, void *buf, u32_t page_
 		io_end_lba = range_end_lba;
 	}
 
-	/* Do the IO! */
-	rc = rw_func(blkdev_pager->dev, io_start_lba, lba_num_blocks_in_range(io_start_lba, io_end_lba), buf);
+	*p_start_lba = io_start_lba;
+	*p_num_blocks = lba_num_blocks_in_range(io_start_lba, io_end_lba);
+}
 
-	return rc;
+/*
+ * Get the number of pages covered by given pager,
+ * counting an incomplete page at the end.
+ */
+static u32_t blockdev_pager_num_pages(struct blockdev_pager *blkdev_pager)
+{
+	return (blkdev_pager->num_blocks + blkdev_pager->num_blocks_per_page - 1)
+		/ blkdev_pager->num_blocks_per_page;
+}
+
+/*
+ * Fill in the buffer segments and find the range of blocks
+ * for an I/O of a run of consecutive pages.
+ * Stores the number of blocks to transfer in *p_num_blocks
+ * and returns 0, or returns EINVAL if the run of pages
+ * isn't within the range covered by the pager.
+ */
+static int blockdev_pager_setup_pages(struct blockdev_pager *blkdev_pager,
+	void **bufs, u32_t page_num, unsigned num_pages, struct blockdev_seg *segs,
+	lba_t *p_lba, unsigned *p_num_blocks)
+{
+	lba_t last_lba;
+	unsigned num_blocks, last_num_blocks;
+	u32_t total_pages;
+	unsigned i;
+
+	KASSERT(num_pages > 0 && num_pages <= VM_PAGER_MAX_PAGES);
+
+	total_pages = blockdev_pager_num_pages(blkdev_pager);
+	if (page_num >= total_pages || num_pages > total_pages - page_num) {
+		return EINVAL;
+	}
+
+	/* only the last page can be incomplete */
+	blockdev_pager_get_io_range(blkdev_pager, page_num, p_lba, &num_blocks);
+	blockdev_pager_get_io_range(blkdev_pager, page_num + num_pages - 1, &last_lba, &last_num_blocks);
+
+	for (i = 0; i < num_pages; i++) {
+		segs[i].buf = bufs[i];
+		segs[i].size = PAGE_SIZE;
+	}
+	segs[num_pages - 1].size =
+		lba_range_size_in_bytes(last_num_blocks, blockdev_get_block_size(blkdev_pager->dev));
+
+	*p_num_blocks = (num_pages - 1) * blkdev_pager->num_blocks_per_page + last_num_blocks;
+	return 0;
+}
+
+/*
+ * Read or write a run of consecutive pages with a single
+ * (scatter/gather) blockdev request.
+ */
+static int blockdev_pager_rw_pages(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages,
+	blockdev_req_type_t type)
+{
+	struct blockdev_pager *blkdev_pager = pager->p;
+	struct blockdev_seg segs[VM_PAGER_MAX_PAGES];
+	lba_t lba;
+	unsigned num_blocks;
+	int rc;
+
+	rc = blockdev_pager_setup_pages(blkdev_pager, bufs, page_num, num_pages, segs, &lba, &num_blocks);
+	if (rc != 0) {
+		return rc;
+	}
+
+	/* Do the IO! */
+	if (type == BLOCKDEV_REQ_READ) {
+		return blockdev_read_sync_sg(blkdev_pager->dev, lba, num_blocks, segs, num_pages);
+	} else {
+		return blockdev_write_sync_sg(blkdev_pager->dev, lba, num_blocks, segs, num_pages);
+	}
 }
 
 static int blockdev_pager_read_page(struct vm_pager *pager, void *buf, u32_t page_num)
 {
-	return blockdev_pager_rw_page(pager, buf, page_num, &blockdev_read_sync);
+	return blockdev_pager_rw_pages(pager, &buf, page_num, 1, BLOCKDEV_REQ_READ);
 }
 
 static int blockdev_pager_write_page(struct vm_pager *pager, void *buf, u32_t page_num)
 {
-	return blockdev_pager_rw_page(pager, buf, page_num, &blockdev_write_sync);
+	return blockdev_pager_rw_pages(pager, &buf, page_num, 1, BLOCKDEV_REQ_WRITE);
+}
+
+static int blockdev_pager_read_pages(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages)
+{
+	return blockdev_pager_rw_pages(pager, bufs, page_num, num_pages, BLOCKDEV_REQ_READ);
+}
+
+static int blockdev_pager_write_pages(struct vm_pager *pager, void **bufs, u32_t page_num, unsigned num_pages)
+{
+	return blockdev_pager_rw_pages(pager, bufs, page_num, num_pages, BLOCKDEV_REQ_WRITE);
+}
+
+/*
+ * Completion callback for asynchronous page reads:
+ * pass the result on to the pager's client.
+ */
+static void blockdev_pager_read_done(struct blockdev_req *req)
+{
+	struct blockdev_pager_io *io = req->callback_data;
+	vm_pager_callback_t *callback = io->callback;
+	void *data = io->data;
+	int rc = req->rc;
+
+	mem_free(io);
+	blockdev_free_request(req->dev, req);
+
+	callback(data, rc);
+}
+
+static int blockdev_pager_read_pages_async(struct vm_pager *pager, void **bufs, u32_t page_num,
+	unsigned num_pages, vm_pager_callback_t *callback, void *data)
+{
+	struct blockdev_pager *blkdev_pager = pager->p;
+	struct blockdev_pager_io *io;
+	struct blockdev_req *req;
+	lba_t lba;
+	unsigned num_blocks;
+	int rc;
+
+	io = mem_alloc(sizeof(struct blockdev_pager_io));
+	io->callback = callback;
+	io->data = data;
+
+	rc = blockdev_pager_setup_pages(blkdev_pager, bufs, page_num, num_pages, io->segs, &lba, &num_blocks);
+	if (rc != 0) {
+		mem_free(io);
+		return rc;
+	}
+
+	req = blockdev_alloc_request(blkdev_pager->dev, lba, num_blocks, io->segs, num_pages, BLOCKDEV_REQ_READ);
+	req->callback = &blockdev_pager_read_done;
+	req->callback_data = io;
+
+	blockdev_post_request(blkdev_pager->dev, req);
+
+	return 0;
+}
+
+static u32_t blockdev_pager_get_num_pages(struct vm_pager *pager)
+{
+	return blockdev_pager_num_pages(pager->p);
 }
 
 struct vm_pager_ops s_blockdev_pager_ops = {
 	.read_page = &blockdev_pager_read_page,
 	.write_page = &blockdev_pager_write_page,
+	.read_pages = &blockdev_pager_read_pages,
+	.write_pages = &blockdev_pager_write_pages,
+	.read_pages_async = &blockdev_pager_read_pages_async,
+	.get_num_pages = &blockdev_pager_get_num_pages,
 };
 
 /*
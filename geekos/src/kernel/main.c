@@ -24,17 +24,23 @@
 #include <geekos/cons.h>
 #include <geekos/mem.h>
 #include <geekos/vm.h>
+#include <geekos/vfs.h>
 #include <geekos/int.h>
 #include <geekos/irq.h>
 #include <geekos/thread.h>
+#include <geekos/smp.h>
 #include <geekos/workqueue.h>
 #include <geekos/timer.h>
+#include <geekos/string.h>
+#include <geekos/slab.h>
 #include <geekos/ramdisk.h>
 #include <geekos/blockdev_pager.h>
 #include <geekos/keyboard.h>
 
 #include <arch/ata.h>
 
+/*#define RUN_BENCHMARKS*/
+
 static void test_thread(ulong_t arg)
 {
 	cons_printf("Test thread: arg=%lx\n", arg);
@@ -49,12 +55,45 @@ static void busy_wait(u32_t ticks)
 	}
 }
 
+#ifdef RUN_BENCHMARKS
+static void run_benchmarks(void)
+{
+	vm_pagecache_benchmark();
+	ramdisk_benchmark();
+	string_benchmark();
+	slab_benchmark();
+	mem_buddy_benchmark();
+}
+#endif
+
+/* maximum length of a console command */
+#define CMD_MAX 32
+
+/*
+ * Run a console command.
+ */
+static void run_command(const char *cmd)
+{
+	if (strcmp(cmd, "threads") == 0) {
+		thread_dump_stats();
+	} else if (strcmp(cmd, "slab") == 0) {
+		slab_dump_stats();
+	} else if (strcmp(cmd, "mem") == 0) {
+		mem_dump_frame_stats();
+	} else if (strcmp(cmd, "locks") == 0) {
+		vm_dump_lock_stats();
+		vfs_dump_lock_stats();
+	} else if (cmd[0] != '\0') {
+		cons_printf("Unknown command: %s (try threads, slab, mem, locks)\n", cmd);
+	}
+}
+
 static void busy_thread(ulong_t arg)
 {
-	busy_wait(90);
+	busy_wait(TIMER_MS_TO_TICKS(5000));
 	while (1) {
 		cons_printf("A");
-		busy_wait(180);
+		busy_wait(TIMER_MS_TO_TICKS(10000));
 	}
 }
 
@@ -64,6 +103,8 @@ void geekos_main(u32_t loader_magic, struct multiboot_info *boot_record)
 	struct vm_pager *vmp;
 	struct blockdev *ramdsk;
 	char ramdsk_buf[1024];
+	char cmd[CMD_MAX];
+	int cmd_len = 0;
 
 	/* Initialize kernel */
 	mem_clear_bss();
@@ -74,11 +115,14 @@ void geekos_main(u32_t loader_magic, struct multiboot_info *boot_record)
 	mem_init(boot_record);
 	int_init();
 	vm_init_paging(boot_record);
+	smp_init();
 	irq_init();
 	thread_init();
 	workqueue_init();
-	ata_init();
+	vm_pagecache_init();
 	timer_init();
+	smp_start_cpus();
+	ata_init();
 	ramdsk = ramdisk_create(ramdsk_buf, 1024);
 	cons_printf("Created block device pager .....%s\n",
 			blockdev_pager_create(ramdsk, lba_from_num(0), 2, &vmp) ?
@@ -96,18 +140,30 @@ void geekos_main(u32_t loader_magic, struct multiboot_info *boot_record)
 		cons_printf("Thread exited with code %d\n", exitcode);
 	}
 
+#ifdef RUN_BENCHMARKS
+	run_benchmarks();
+#endif
+
 	thread_create(&busy_thread, 0, THREAD_DETACHED);
 
 	/* see if timer is ticking */
-	busy_wait(180);
+	thread_sleep(TIMER_MS_TO_NS(10000));
 	cons_printf("wait ...\n");
-	busy_wait(180);
+	thread_sleep(TIMER_MS_TO_NS(10000));
 	cons_printf("$ ");
 
 	while (1) {
                 keycode = wait_for_key();
-                if (' ' <= keycode && keycode <= '~')
+		if (keycode == '\r') {
+			cons_printf("\n");
+			cmd[cmd_len] = '\0';
+			run_command(cmd);
+			cmd_len = 0;
+			cons_printf("$ ");
+		} else if (' ' <= keycode && keycode <= '~' && cmd_len < CMD_MAX - 1) {
 			cons_printf("%c", keycode);
+			cmd[cmd_len++] = keycode;
+		}
 	}
 
 #if 0
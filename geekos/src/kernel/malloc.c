@@ -252,3 +252,33 @@ free(void *p)
 		fp2->nx = fpnew->nx;
 	}
 }
+
+/*
+ * GeekOS: add a region of memory to the heap.
+ * If the region directly follows the end of the heap, the heap
+ * is simply extended.  Otherwise, whatever is left of the current
+ * region is put on the freelist, and new chunks are carved from
+ * the new region.
+ */
+void
+malloc_add_region(char *start, char *end)
+{
+	struct __freelist *fp;
+
+	if (__brkval == 0)
+		__brkval = __malloc_heap_start;
+
+	if (start == __malloc_heap_end) {
+		__malloc_heap_end = end;
+		return;
+	}
+
+	if ((size_t)(__malloc_heap_end - __brkval) >= sizeof(struct __freelist)) {
+		fp = (struct __freelist *)__brkval;
+		fp->sz = __malloc_heap_end - __brkval - sizeof(size_t);
+		free(&(fp->nx));
+	}
+
+	__malloc_heap_start = __brkval = start;
+	__malloc_heap_end = end;
+}
@@ -21,9 +21,30 @@
 #include <geekos/int.h>
 #include <geekos/string.h>
 #include <geekos/thread.h>
+#include <geekos/slab.h>
+#include <geekos/timer.h>
+#include <geekos/cons.h>
 
+/* initial size of the kernel heap */
 #define HEAP_SIZE (512*1024)
 
+/*
+ * When the heap is exhausted, it grows by a block of at least
+ * 2^HEAP_GROW_MIN_ORDER frames.
+ */
+#define HEAP_GROW_MIN_ORDER 6
+
+/*
+ * Frame reclaim watermarks: when the number of free frames drops
+ * below MEM_LOW_WATERMARK, the reclaim thread is woken up,
+ * and evicts frames until MEM_HIGH_WATERMARK frames are free.
+ */
+#define MEM_LOW_WATERMARK  64
+#define MEM_HIGH_WATERMARK 128
+
+/* number of pre-zeroed frames the idle thread tries to keep ready */
+#define MEM_ZERO_POOL_SIZE 32
+
 IMPLEMENT_LIST_CLEAR(frame_list, frame)
 IMPLEMENT_LIST_APPEND(frame_list, frame)
 IMPLEMENT_LIST_IS_EMPTY(frame_list, frame)
@@ -32,12 +53,34 @@ IMPLEMENT_LIST_GET_FIRST(frame_list, frame)
 IMPLEMENT_LIST_REMOVE(frame_list, frame)
 IMPLEMENT_LIST_NEXT(frame_list, frame)
 
+/*
+ * NOTES:
+ * - Free frames are managed by a binary buddy allocator.
+ *   A free block of order n is 2^n frames, starting at a frame
+ *   number that is a multiple of 2^n.  Its first frame is on
+ *   s_free_area[n], with free_head set and order == n.
+ *   All frames of a free block have state FRAME_AVAIL.
+ * - When a block is freed, it is merged with its buddy
+ *   (the other half of the next larger block) as long as
+ *   the buddy is also free.
+ * - The free lists are only accessed with interrupts disabled.
+ */
+
 static ulong_t s_numframes;
 static struct frame *s_framelist;
-static struct frame_list s_freelist;
+static struct frame_list s_free_area[MEM_MAX_ORDER + 1];
+static ulong_t s_num_free_blocks[MEM_MAX_ORDER + 1];
+static ulong_t s_num_free_frames;
 
+/* pre-zeroed frames for mem_alloc_zeroed_frame() */
+static struct frame_list s_zero_pool;
+static ulong_t s_zero_pool_count;
+static ulong_t s_zero_pool_hits, s_zero_pool_misses;
+
+static ulong_t s_heap_size;
 static struct thread_queue s_heap_waitqueue;
 static struct thread_queue s_frame_waitqueue;
+static struct thread_queue s_reclaim_waitqueue;
 
 struct scan_region_data {
 	bool heap_created;
@@ -53,6 +96,103 @@ static void mem_heap_init(ulong_t start, ulong_t end)
 	g_heapend   = (char *) end;
 }
 
+/*
+ * Put a free block on the free list for its order.
+ */
+static void mem_buddy_insert(struct frame *frame, unsigned order)
+{
+	frame->order = order;
+	frame->free_head = true;
+	frame_list_append(&s_free_area[order], frame);
+	s_num_free_blocks[order]++;
+}
+
+static void mem_buddy_remove(struct frame *frame, unsigned order)
+{
+	KASSERT(frame->free_head && frame->order == order);
+	frame_list_remove(&s_free_area[order], frame);
+	frame->free_head = false;
+	s_num_free_blocks[order]--;
+}
+
+/*
+ * Allocate a block of 2^order frames, splitting a larger
+ * block if necessary.  Returns the first frame of the block,
+ * or null if there is no free block large enough.
+ * Interrupts must be disabled.
+ */
+static struct frame *mem_buddy_alloc(unsigned order)
+{
+	struct frame *frame;
+	unsigned k;
+
+	KASSERT(!int_enabled());
+	KASSERT(order <= MEM_MAX_ORDER);
+
+	for (k = order; k <= MEM_MAX_ORDER && frame_list_is_empty(&s_free_area[k]); k++) {
+	}
+	if (k > MEM_MAX_ORDER) {
+		return 0;
+	}
+
+	frame = frame_list_get_first(&s_free_area[k]);
+	mem_buddy_remove(frame, k);
+
+	/* return the upper halves of the block to the free lists */
+	while (k > order) {
+		k--;
+		mem_buddy_insert(frame + (1UL << k), k);
+	}
+
+	s_num_free_frames -= 1UL << order;
+	return frame;
+}
+
+/*
+ * Free a block of 2^order frames, merging it with free buddies.
+ * Interrupts must be disabled.
+ */
+static void mem_buddy_free(struct frame *frame, unsigned order)
+{
+	ulong_t num = frame - s_framelist;
+	ulong_t buddy_num;
+	struct frame *buddy;
+
+	KASSERT(!int_enabled());
+	KASSERT((num & ((1UL << order) - 1)) == 0);
+
+	s_num_free_frames += 1UL << order;
+
+	while (order < MEM_MAX_ORDER) {
+		buddy_num = num ^ (1UL << order);
+		if (buddy_num >= s_numframes) {
+			break;
+		}
+		buddy = &s_framelist[buddy_num];
+		if (!buddy->free_head || buddy->order != order) {
+			break;
+		}
+		mem_buddy_remove(buddy, order);
+		num &= ~(1UL << order);
+		order++;
+	}
+
+	mem_buddy_insert(&s_framelist[num], order);
+}
+
+/*
+ * Get the smallest order of a block containing at least num_frames frames.
+ */
+static unsigned mem_order_for(ulong_t num_frames)
+{
+	unsigned order = 0;
+
+	while ((1UL << order) < num_frames) {
+		order++;
+	}
+	return order;
+}
+
 static void mem_set_region_state(ulong_t start, ulong_t end, frame_state_t state)
 {
 	ulong_t addr;
@@ -61,7 +201,7 @@ static void mem_set_region_state(ulong_t start, ulong_t end, frame_state_t state
 		struct frame *frame = &s_framelist[addr / PAGE_SIZE];
 		frame->state = state;
 		if (state == FRAME_AVAIL) {
-			frame_list_append(&s_freelist, frame);
+			mem_buddy_free(frame, 0);
 		}
 	}
 }
@@ -88,6 +228,55 @@ static ulong_t mem_scan_region(ulong_t start, ulong_t end, frame_state_t state,
 	return end;
 }
 
+/*
+ * Grow the kernel heap so that an allocation of given size can succeed.
+ * Returns true if successful, false if there is no free block
+ * large enough (or taking one would leave too few free frames).
+ * Interrupts must be disabled.
+ */
+static bool mem_heap_grow(size_t size)
+{
+	extern void malloc_add_region(char *start, char *end);
+	struct frame *frame = 0;
+	ulong_t i, num_frames;
+	unsigned order;
+	char *start;
+
+	KASSERT(!int_enabled());
+
+	/* allow for malloc's chunk header */
+	order = mem_order_for(mem_round_to_page(size + 2*sizeof(size_t)) / PAGE_SIZE);
+	if (order > MEM_MAX_ORDER) {
+		return false;
+	}
+
+	/* prefer growing by a reasonably large block */
+	if (order < HEAP_GROW_MIN_ORDER
+	    && s_num_free_frames >= (1UL << HEAP_GROW_MIN_ORDER) + MEM_LOW_WATERMARK) {
+		frame = mem_buddy_alloc(HEAP_GROW_MIN_ORDER);
+		if (frame != 0) {
+			order = HEAP_GROW_MIN_ORDER;
+		}
+	}
+	if (frame == 0 && s_num_free_frames >= (1UL << order) + MEM_LOW_WATERMARK) {
+		frame = mem_buddy_alloc(order);
+	}
+	if (frame == 0) {
+		return false;
+	}
+
+	num_frames = 1UL << order;
+	for (i = 0; i < num_frames; i++) {
+		frame[i].state = FRAME_HEAP;
+	}
+
+	start = mem_frame_to_pa(frame);
+	malloc_add_region(start, start + num_frames * PAGE_SIZE);
+	s_heap_size += num_frames * PAGE_SIZE;
+
+	return true;
+}
+
 void mem_clear_bss(void)
 {
 	extern char __bss_start, end;
@@ -103,35 +292,59 @@ void mem_init(struct multiboot_info *boot_record)
 	mem_scan_regions(boot_record, &mem_scan_region, &data);
 
 	PANIC_IF(!data.heap_created, "Couldn't create kernel heap!");
+	s_heap_size = data.heap_size;
 
 	cons_printf("Memory: %u bytes in heap, %u available pages\n",
 		data.heap_size, data.avail_pages);
 }
 
 /*
- * Allocate a buffer in the kernel heap.
+ * Allocate a buffer in kernel memory, without initializing it.
+ * Small buffers come from the slab allocator's size class
+ * caches; larger ones are allocated from the kernel heap,
+ * which grows as needed using free frames.
  * Suspends calling thread until enough memory
  * is available to satisfy the request.
- * The returned buffer is filled with zeroes.
  *
  * Parameters:
  *   size - size in bytes of buffer to allocate
  *
  * Returns:
- *   pointer to allocated, zero-filled buffer
+ *   pointer to allocated buffer
  */
-void *mem_alloc(size_t size)
+void *mem_alloc_nozero(size_t size)
 {
 	extern void *malloc(size_t);
 	void *buf;
 	bool iflag;
 
+	if (size <= SLAB_MAX_SIZE) {
+		return slab_alloc_nozero(slab_get_size_cache(size));
+	}
+
 	iflag = int_begin_atomic();
 	while ((buf = malloc(size)) == 0) {
-		thread_wait(&s_heap_waitqueue);
+		if (!mem_heap_grow(size)) {
+			/* wait for memory to be freed, either in the heap or as frames */
+			thread_wakeup(&s_reclaim_waitqueue);
+			thread_wait(&s_heap_waitqueue);
+		}
 	}
 	int_end_atomic(iflag);
 
+	return buf;
+}
+
+/*
+ * Allocate a buffer in kernel memory, as with mem_alloc_nozero().
+ * The returned buffer is filled with zeroes.
+ * Callers that overwrite the whole buffer anyway
+ * should use mem_alloc_nozero().
+ */
+void *mem_alloc(size_t size)
+{
+	void *buf = mem_alloc_nozero(size);
+
 	/* fill buffer with zeroes */
 	memset(buf, '\0', size);
 
@@ -140,18 +353,22 @@ void *mem_alloc(size_t size)
 
 /*
  * Free memory allocated with mem_alloc()
+ * (or with slab_alloc()).
  */
 void mem_free(void *p)
 {
 	extern void free(void *);
-	extern char *g_heapstart, *g_heapend;
 	bool iflag;
 
 	if (!p) {
 		return;
 	}
 
-	KASSERT(((char *) p) >= g_heapstart && ((char *) p) < g_heapend);
+	if (mem_pa_to_frame(p)->state != FRAME_HEAP) {
+		/* not in the heap, so it must be a slab object */
+		slab_free(slab_get_cache(p), p);
+		return;
+	}
 
 	iflag = int_begin_atomic();
 
@@ -175,14 +392,52 @@ struct frame *mem_alloc_frame(frame_state_t initial_state, int initial_refcount)
 
 	iflag = int_begin_atomic();
 
-	while (frame_list_is_empty(&s_freelist)) {
+	while ((frame = mem_buddy_alloc(0)) == 0) {
+		if (!frame_list_is_empty(&s_zero_pool)) {
+			/* last resort: use a frame from the zero pool */
+			frame = frame_list_remove_first(&s_zero_pool);
+			s_zero_pool_count--;
+			break;
+		}
+		thread_wakeup(&s_reclaim_waitqueue);
 		thread_wait(&s_frame_waitqueue);
 	}
 
-	frame = frame_list_remove_first(&s_freelist);
 	frame->state = initial_state;
 	frame->refcount = initial_refcount;
 
+	/* start reclaiming frames if we're running low */
+	if (s_num_free_frames < MEM_LOW_WATERMARK) {
+		thread_wakeup(&s_reclaim_waitqueue);
+	}
+
+	int_end_atomic(iflag);
+
+	return frame;
+}
+
+/*
+ * Allocate a physical memory frame if one is free, without waiting.
+ * Returns null if no frame is available.
+ */
+struct frame *mem_try_alloc_frame(frame_state_t initial_state, int initial_refcount)
+{
+	struct frame *frame;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+
+	frame = mem_buddy_alloc(0);
+	if (frame != 0) {
+		frame->state = initial_state;
+		frame->refcount = initial_refcount;
+	}
+
+	/* start reclaiming frames if we're running low */
+	if (s_num_free_frames < MEM_LOW_WATERMARK) {
+		thread_wakeup(&s_reclaim_waitqueue);
+	}
+
 	int_end_atomic(iflag);
 
 	return frame;
@@ -200,14 +455,212 @@ void mem_free_frame(struct frame *frame)
 	iflag = int_begin_atomic();
 
 	frame->state = FRAME_AVAIL;
-	frame_list_append(&s_freelist, frame);
+	mem_buddy_free(frame, 0);
 
-	/* wake up any threads waiting for a frame */
+	/* wake up any threads waiting for a frame, or for the heap to grow */
 	thread_wakeup(&s_frame_waitqueue);
+	thread_wakeup(&s_heap_waitqueue);
 
 	int_end_atomic(iflag);
 }
 
+/*
+ * Allocate a physical memory frame whose contents are zero.
+ * Frames are taken from the pool of frames zeroed in advance
+ * by the idle thread if possible, so the caller doesn't
+ * pay for clearing them.
+ * Suspends calling thread until a frame is available.
+ */
+struct frame *mem_alloc_zeroed_frame(frame_state_t initial_state, int initial_refcount)
+{
+	struct frame *frame = 0;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+	if (!frame_list_is_empty(&s_zero_pool)) {
+		frame = frame_list_remove_first(&s_zero_pool);
+		s_zero_pool_count--;
+		s_zero_pool_hits++;
+		frame->state = initial_state;
+		frame->refcount = initial_refcount;
+	} else {
+		s_zero_pool_misses++;
+	}
+	int_end_atomic(iflag);
+
+	if (frame == 0) {
+		frame = mem_alloc_frame(initial_state, initial_refcount);
+		memset(mem_frame_to_pa(frame), '\0', PAGE_SIZE);
+	}
+
+	return frame;
+}
+
+/*
+ * Zero one free frame and add it to the zero pool, if the pool
+ * isn't full and free frames aren't scarce.
+ * Called by the idle thread.
+ * Returns true if a frame was added to the pool.
+ */
+bool mem_refill_zero_pool(void)
+{
+	struct frame *frame;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+	if (s_zero_pool_count >= MEM_ZERO_POOL_SIZE || s_num_free_frames < MEM_HIGH_WATERMARK) {
+		int_end_atomic(iflag);
+		return false;
+	}
+	frame = mem_buddy_alloc(0);
+	frame->state = FRAME_KERN;
+	frame->refcount = 0;
+	int_end_atomic(iflag);
+
+	/* clear the frame without holding off interrupts */
+	memset(mem_frame_to_pa(frame), '\0', PAGE_SIZE);
+
+	iflag = int_begin_atomic();
+	frame_list_append(&s_zero_pool, frame);
+	s_zero_pool_count++;
+	int_end_atomic(iflag);
+
+	return true;
+}
+
+/*
+ * Allocate a block of 2^order physically contiguous frames.
+ * Unlike mem_alloc_frame(), does not wait: returns null
+ * if there is no free block large enough.
+ * Returns the first frame of the block; the frames are
+ * consecutive in the framelist (and in physical memory).
+ */
+struct frame *mem_alloc_frames(frame_state_t initial_state, int initial_refcount, unsigned order)
+{
+	struct frame *frame;
+	ulong_t i;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+
+	frame = mem_buddy_alloc(order);
+	if (frame != 0) {
+		for (i = 0; i < (1UL << order); i++) {
+			frame[i].state = initial_state;
+			frame[i].refcount = initial_refcount;
+		}
+	}
+
+	if (s_num_free_frames < MEM_LOW_WATERMARK) {
+		thread_wakeup(&s_reclaim_waitqueue);
+	}
+
+	int_end_atomic(iflag);
+
+	return frame;
+}
+
+/*
+ * Free a block of frames allocated with mem_alloc_frames().
+ */
+void mem_free_frames(struct frame *frame, unsigned order)
+{
+	ulong_t i;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+
+	for (i = 0; i < (1UL << order); i++) {
+		KASSERT(frame[i].refcount == 0);
+		frame[i].state = FRAME_AVAIL;
+	}
+	mem_buddy_free(frame, order);
+
+	thread_wakeup(&s_frame_waitqueue);
+	thread_wakeup(&s_heap_waitqueue);
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Print the number of free blocks of each order, and for
+ * selected orders the fraction of free memory that can't be used
+ * to satisfy an allocation of that order (0% means no fragmentation).
+ */
+void mem_dump_frame_stats(void)
+{
+	ulong_t counts[MEM_MAX_ORDER + 1];
+	ulong_t num_free, usable, pool_count, pool_hits, pool_misses;
+	unsigned order, k;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+	memcpy(counts, s_num_free_blocks, sizeof(counts));
+	num_free = s_num_free_frames;
+	pool_count = s_zero_pool_count;
+	pool_hits = s_zero_pool_hits;
+	pool_misses = s_zero_pool_misses;
+	int_end_atomic(iflag);
+
+	cons_printf("zero pool: %lu frames, %lu hits, %lu misses\n", pool_count, pool_hits, pool_misses);
+
+	cons_printf("free frames: %lu, free blocks by order:", num_free);
+	for (order = 0; order <= MEM_MAX_ORDER; order++) {
+		cons_printf(" %lu", counts[order]);
+	}
+	cons_printf("\n");
+
+	if (num_free == 0) {
+		return;
+	}
+	for (order = 2; order <= MEM_MAX_ORDER; order += 4) {
+		usable = 0;
+		for (k = order; k <= MEM_MAX_ORDER; k++) {
+			usable += counts[k] << k;
+		}
+		cons_printf("  order %u: %lu%% unusable\n", order, ((num_free - usable) * 100) / num_free);
+	}
+}
+
+/*
+ * Called by the frame reclaim thread to wait until
+ * free frames are running low.
+ * Returns the number of frames that should be reclaimed.
+ */
+ulong_t mem_wait_for_reclaim(void)
+{
+	ulong_t target;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+
+	while (s_num_free_frames >= MEM_LOW_WATERMARK && thread_queue_is_empty(&s_frame_waitqueue)) {
+		thread_wait(&s_reclaim_waitqueue);
+	}
+
+	target = (s_num_free_frames < MEM_HIGH_WATERMARK) ? MEM_HIGH_WATERMARK - s_num_free_frames : 1;
+
+	int_end_atomic(iflag);
+
+	return target;
+}
+
+/*
+ * Get the current size of the kernel heap in bytes.
+ */
+ulong_t mem_get_heap_size(void)
+{
+	return s_heap_size;
+}
+
+/*
+ * Get the number of frames currently on the freelist.
+ */
+ulong_t mem_get_num_free_frames(void)
+{
+	return s_num_free_frames;
+}
+
 void *mem_frame_to_pa(struct frame *frame)
 {
 	ulong_t offset = frame - s_framelist;
@@ -232,3 +685,67 @@ bool mem_is_page_aligned(ulong_t addr)
 {
 	return mem_round_to_page(addr) == addr;
 }
+
+/* ----------------------------------------------------------------------
+ * Benchmarks
+ * ---------------------------------------------------------------------- */
+
+#define MEM_BENCH_NUM_SLOTS 128
+#define MEM_BENCH_MAX_ORDER 3
+#define MEM_BENCH_NUM_ITERS 20000
+
+/*
+ * Stress the buddy allocator with a random mix of allocations
+ * and frees of blocks of 1 to 8 frames, and report the cost of
+ * each operation and the resulting fragmentation.
+ */
+void mem_buddy_benchmark(void)
+{
+	static struct frame *blocks[MEM_BENCH_NUM_SLOTS];
+	static unsigned orders[MEM_BENCH_NUM_SLOTS];
+	u32_t rand = 12345, i, slot, num_allocs = 0, num_frees = 0, num_failed = 0;
+	u64_t start, alloc_cycles = 0, free_cycles = 0;
+
+	cons_printf("buddy allocator benchmark:\n");
+
+	/* leave plenty of frames for the rest of the kernel */
+	if (mem_get_num_free_frames() < MEM_BENCH_NUM_SLOTS * (1 << MEM_BENCH_MAX_ORDER) + 256) {
+		cons_printf("  skipped (not enough memory)\n");
+		return;
+	}
+
+	for (i = 0; i < MEM_BENCH_NUM_ITERS; i++) {
+		rand = rand * 1103515245 + 12345;
+		slot = (rand >> 16) % MEM_BENCH_NUM_SLOTS;
+
+		start = timer_read_cycles();
+		if (blocks[slot] != 0) {
+			mem_free_frames(blocks[slot], orders[slot]);
+			free_cycles += timer_read_cycles() - start;
+			blocks[slot] = 0;
+			num_frees++;
+		} else {
+			orders[slot] = (rand >> 8) % (MEM_BENCH_MAX_ORDER + 1);
+			blocks[slot] = mem_alloc_frames(FRAME_KERN, 0, orders[slot]);
+			alloc_cycles += timer_read_cycles() - start;
+			if (blocks[slot] != 0) {
+				num_allocs++;
+			} else {
+				num_failed++;
+			}
+		}
+	}
+
+	cons_printf("  %lu allocs (%lu failed): %lu cycles each, %lu frees: %lu cycles each\n",
+		num_allocs, num_failed, ((u32_t) alloc_cycles) / (num_allocs + num_failed),
+		num_frees, ((u32_t) free_cycles) / num_frees);
+	cons_printf("  with %lu blocks still allocated: ", num_allocs - num_frees);
+	mem_dump_frame_stats();
+
+	for (slot = 0; slot < MEM_BENCH_NUM_SLOTS; slot++) {
+		if (blocks[slot] != 0) {
+			mem_free_frames(blocks[slot], orders[slot]);
+			blocks[slot] = 0;
+		}
+	}
+}
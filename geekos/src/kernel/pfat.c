@@ -28,6 +28,7 @@
 #include <geekos/synch.h>
 #include <geekos/vm.h>
 #include <geekos/pfat.h>
+#include <arch/atomic.h>
 
 /*
  * NOTES:
@@ -116,7 +117,7 @@ static int pfat_read_super(struct blockdev *dev, struct pfat_superblock **p_supe
 
 	/* read superblock into a buffer */
 	super_bufsize = range_umax(sizeof(struct pfat_superblock), blocksize_size(dev_block_size));
-	super = mem_alloc(super_bufsize);
+	super = mem_alloc_nozero(super_bufsize); /* contents are read from disk */
 	rc = blockdev_read_sync(dev, lba_from_num(0), super_bufsize / blocksize_size(dev_block_size), super);
 	if (rc != 0) {
 		goto fail;
@@ -129,6 +130,7 @@ static int pfat_read_super(struct blockdev *dev, struct pfat_superblock **p_supe
 	}
 
 	/* success! */
+	*p_super = super;
 	return 0;
 
 fail:
@@ -276,7 +278,7 @@ static int pfat_get_root(struct fs_instance *instance, struct inode **p_dir)
 		 * root directory inode.
 		 */
 		*p_dir = inst_data->root_dir;
-		(*p_dir)->refcount++;
+		atomic_fetch_add(&(*p_dir)->refcount, 1);
 		rc = 0;
 	}
 	KASSERT(rc != 0 || (*p_dir)->refcount > 0);
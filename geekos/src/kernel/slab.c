@@ -0,0 +1,316 @@
+/*
+ * GeekOS - slab allocator
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/slab.h>
+#include <geekos/mem.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/timer.h>
+#include <geekos/cons.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Each slab is one page frame.  The slab header is at the start
+ *   of the page, followed by the objects, so the slab containing
+ *   an object is found by rounding its address down to a page boundary.
+ * - Free objects in a slab form a singly linked list threaded
+ *   through the objects themselves.
+ * - Slab caches may be used from interrupt handlers (e.g., to free
+ *   blockdev requests), so they are only accessed with interrupts disabled.
+ * - A cache keeps at most one empty slab; other slabs are returned
+ *   to the frame allocator as soon as they become empty.
+ */
+
+#define SLAB_MAGIC 0x51AB51ABUL
+#define SLAB_ALIGN 8
+
+struct slab_free_obj {
+	struct slab_free_obj *next;
+};
+
+struct slab {
+	u32_t magic;
+	struct slab_cache *cache;
+	struct slab_free_obj *free;   /* free objects */
+	unsigned num_used;            /* objects in use */
+	DEFINE_LINK(slab_list, slab);
+};
+
+#define SLAB_ROUND_UP(n) (((n) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+#define SLAB_HEADER_SIZE SLAB_ROUND_UP(sizeof(struct slab))
+
+IMPLEMENT_LIST_IS_EMPTY(slab_list, slab)
+IMPLEMENT_LIST_APPEND(slab_list, slab)
+IMPLEMENT_LIST_PREPEND(slab_list, slab)
+IMPLEMENT_LIST_GET_FIRST(slab_list, slab)
+IMPLEMENT_LIST_REMOVE(slab_list, slab)
+IMPLEMENT_LIST_APPEND(slab_cache_list, slab_cache)
+IMPLEMENT_LIST_GET_FIRST(slab_cache_list, slab_cache)
+IMPLEMENT_LIST_NEXT(slab_cache_list, slab_cache)
+
+/* all caches that have been used, for statistics */
+static struct slab_cache_list s_cache_list;
+
+/* size class caches used by mem_alloc() */
+static struct slab_cache s_size_caches[] = {
+	SLAB_CACHE_INITIALIZER("size-16", 16),
+	SLAB_CACHE_INITIALIZER("size-32", 32),
+	SLAB_CACHE_INITIALIZER("size-64", 64),
+	SLAB_CACHE_INITIALIZER("size-128", 128),
+	SLAB_CACHE_INITIALIZER("size-256", 256),
+	SLAB_CACHE_INITIALIZER("size-512", 512),
+	SLAB_CACHE_INITIALIZER("size-1024", SLAB_MAX_SIZE),
+};
+#define SLAB_NUM_SIZE_CACHES (sizeof(s_size_caches) / sizeof(s_size_caches[0]))
+
+/* ------------------- private implementation ------------------- */
+
+/*
+ * Set up a statically initialized cache on first use.
+ */
+static void slab_cache_setup(struct slab_cache *cache)
+{
+	cache->obj_size = SLAB_ROUND_UP(cache->obj_size);
+	if (cache->obj_size < sizeof(struct slab_free_obj)) {
+		cache->obj_size = SLAB_ROUND_UP(sizeof(struct slab_free_obj));
+	}
+	cache->objs_per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->obj_size;
+	KASSERT(cache->objs_per_slab > 0);
+
+	slab_cache_list_append(&s_cache_list, cache);
+}
+
+/*
+ * Add a new slab to given cache.
+ * Interrupts must be disabled.
+ */
+static void slab_cache_grow(struct slab_cache *cache)
+{
+	struct slab *slab;
+	char *obj;
+	unsigned i;
+
+	KASSERT(!int_enabled());
+
+	slab = mem_frame_to_pa(mem_alloc_frame(FRAME_SLAB, 0));
+	slab->magic = SLAB_MAGIC;
+	slab->cache = cache;
+	slab->num_used = 0;
+
+	/* build the free list in address order */
+	slab->free = 0;
+	obj = (char *) slab + SLAB_HEADER_SIZE + (cache->objs_per_slab - 1) * cache->obj_size;
+	for (i = 0; i < cache->objs_per_slab; i++) {
+		((struct slab_free_obj *) obj)->next = slab->free;
+		slab->free = (struct slab_free_obj *) obj;
+		obj -= cache->obj_size;
+	}
+
+	slab_list_append(&cache->partial, slab);
+	cache->num_slabs++;
+	cache->num_empty++;
+}
+
+/* ------------------- public interface ------------------- */
+
+/*
+ * Allocate an object from given cache, without initializing it.
+ * Suspends the calling thread if no memory is available.
+ */
+void *slab_alloc_nozero(struct slab_cache *cache)
+{
+	struct slab *slab;
+	struct slab_free_obj *obj;
+	u64_t start;
+	u32_t cycles;
+	bool iflag;
+
+	start = timer_read_cycles();
+	iflag = int_begin_atomic();
+
+	if (cache->objs_per_slab == 0) {
+		slab_cache_setup(cache);
+	}
+	if (slab_list_is_empty(&cache->partial)) {
+		slab_cache_grow(cache);
+	}
+
+	slab = slab_list_get_first(&cache->partial);
+	obj = slab->free;
+	slab->free = obj->next;
+	if (slab->num_used++ == 0) {
+		cache->num_empty--;
+	}
+	if (slab->free == 0) {
+		/* slab is full */
+		slab_list_remove(&cache->partial, slab);
+	}
+
+	cache->num_used++;
+	cache->num_allocs++;
+	cycles = (u32_t) (timer_read_cycles() - start);
+	cache->avg_alloc_cycles += ((long) cycles - (long) cache->avg_alloc_cycles) / 8;
+	if (cycles > cache->max_alloc_cycles) {
+		cache->max_alloc_cycles = cycles;
+	}
+
+	int_end_atomic(iflag);
+
+	return obj;
+}
+
+/*
+ * Allocate a zero-filled object from given cache.
+ * Suspends the calling thread if no memory is available.
+ */
+void *slab_alloc(struct slab_cache *cache)
+{
+	void *obj = slab_alloc_nozero(cache);
+
+	memset(obj, '\0', cache->obj_size);
+	return obj;
+}
+
+/*
+ * Return an object to the cache it was allocated from.
+ * May be called from interrupt context.
+ */
+void slab_free(struct slab_cache *cache, void *obj)
+{
+	struct slab *slab;
+	bool iflag;
+
+	slab = (struct slab *) ((ulong_t) obj & ~(PAGE_SIZE - 1));
+	KASSERT(slab->magic == SLAB_MAGIC);
+	KASSERT(slab->cache == cache);
+	KASSERT(slab->num_used > 0);
+
+	iflag = int_begin_atomic();
+
+	if (slab->free == 0) {
+		/* slab was full: it has a free object again */
+		slab_list_prepend(&cache->partial, slab);
+	}
+	((struct slab_free_obj *) obj)->next = slab->free;
+	slab->free = obj;
+	cache->num_used--;
+	cache->num_frees++;
+
+	if (--slab->num_used == 0) {
+		if (cache->num_empty > 0) {
+			/* already have a spare slab: give this one back */
+			slab_list_remove(&cache->partial, slab);
+			cache->num_slabs--;
+			slab->magic = 0;
+			mem_free_frame(mem_pa_to_frame(slab));
+		} else {
+			cache->num_empty++;
+		}
+	}
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Get the smallest size class cache whose objects can hold given size.
+ * Returns null if size is larger than SLAB_MAX_SIZE.
+ */
+struct slab_cache *slab_get_size_cache(size_t size)
+{
+	unsigned i;
+
+	for (i = 0; i < SLAB_NUM_SIZE_CACHES; i++) {
+		if (size <= s_size_caches[i].obj_size) {
+			return &s_size_caches[i];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Get the cache an object was allocated from.
+ */
+struct slab_cache *slab_get_cache(void *obj)
+{
+	struct slab *slab = (struct slab *) ((ulong_t) obj & ~(PAGE_SIZE - 1));
+
+	KASSERT(mem_pa_to_frame(slab)->state == FRAME_SLAB);
+	KASSERT(slab->magic == SLAB_MAGIC);
+	return slab->cache;
+}
+
+/*
+ * Print occupancy and allocation latency of each cache.
+ */
+void slab_dump_stats(void)
+{
+	struct slab_cache *cache;
+
+	cons_printf("slab caches:\n");
+	for (cache = slab_cache_list_get_first(&s_cache_list);
+	     cache != 0;
+	     cache = slab_cache_list_next(cache)) {
+		cons_printf("  %s: %lu bytes, %u/%u objects used, %u slabs, %lu allocs, %lu/%lu avg/max cycles\n",
+			cache->name, (ulong_t) cache->obj_size,
+			cache->num_used, cache->num_slabs * cache->objs_per_slab,
+			cache->num_slabs, cache->num_allocs,
+			cache->avg_alloc_cycles, cache->max_alloc_cycles);
+	}
+}
+
+/* ----------------------------------------------------------------------
+ * Benchmarks
+ * ---------------------------------------------------------------------- */
+
+#define SLAB_BENCH_NUM_OBJS 256
+
+/*
+ * Compare mem_alloc()/mem_free() latency for sizes served by
+ * slab caches and by malloc().
+ */
+void slab_benchmark(void)
+{
+	static void *objs[SLAB_BENCH_NUM_OBJS];
+	static const size_t sizes[] = { 24, 100, 600, 2000 };
+	u64_t start, alloc_cycles, free_cycles;
+	unsigned i, j;
+
+	cons_printf("mem_alloc benchmark:\n");
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		start = timer_read_cycles();
+		for (i = 0; i < SLAB_BENCH_NUM_OBJS; i++) {
+			objs[i] = mem_alloc(sizes[j]);
+		}
+		alloc_cycles = timer_read_cycles() - start;
+
+		start = timer_read_cycles();
+		for (i = 0; i < SLAB_BENCH_NUM_OBJS; i++) {
+			mem_free(objs[i]);
+		}
+		free_cycles = timer_read_cycles() - start;
+
+		cons_printf("  %lu bytes (%s): %lu cycles per alloc, %lu per free\n",
+			(ulong_t) sizes[j], sizes[j] <= SLAB_MAX_SIZE ? "slab" : "malloc",
+			((u32_t) alloc_cycles) / SLAB_BENCH_NUM_OBJS,
+			((u32_t) free_cycles) / SLAB_BENCH_NUM_OBJS);
+	}
+
+	slab_dump_stats();
+}
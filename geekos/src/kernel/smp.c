@@ -0,0 +1,101 @@
+/*
+ * GeekOS - symmetric multiprocessing
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/smp.h>
+#include <geekos/spinlock.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - The kernel is protected by a single kernel lock, which is
+ *   acquired whenever a CPU disables interrupts and released
+ *   whenever it enables them again.  Code that relied on disabling
+ *   interrupts to get exclusive access to kernel data on a
+ *   uniprocessor therefore works unchanged on a multiprocessor.
+ * - A CPU holds the kernel lock exactly when its interrupts are
+ *   disabled.  Interrupt handlers acquire it on entry if the
+ *   interrupted code had interrupts enabled, and release it on
+ *   exit (see smp_int_enter() and smp_int_exit()).  A thread that
+ *   switches to another thread with interrupts disabled passes
+ *   the lock on to that thread.
+ * - Until the application processors are started, only one
+ *   CPU is running, and the kernel lock isn't used.
+ */
+
+struct cpu g_cpus[CPU_MAX];
+int g_num_cpus = 1;
+
+static struct spinlock s_kernel_lock = SPINLOCK_INITIALIZER;
+static volatile int s_kernel_lock_owner = -1;
+static bool s_kernel_lock_active;
+
+/*
+ * Initialize the per-CPU data.
+ * Called very early, when the GDT is created.
+ */
+void smp_init_cpus(void)
+{
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		g_cpus[i].self = &g_cpus[i];
+		g_cpus[i].id = i;
+	}
+
+	/* the bootstrap processor is running */
+	g_cpus[0].online = true;
+}
+
+/*
+ * Start using the kernel lock.
+ * Must be called before any application processor is started,
+ * with interrupts enabled.
+ */
+void smp_activate_kernel_lock(void)
+{
+	KASSERT(int_enabled());
+	s_kernel_lock_active = true;
+}
+
+/*
+ * Acquire the kernel lock.
+ * Interrupts must be disabled.
+ */
+void smp_lock_kernel(void)
+{
+	if (s_kernel_lock_active) {
+		KASSERT(s_kernel_lock_owner != cpu_self()->id);
+		spin_lock(&s_kernel_lock);
+		s_kernel_lock_owner = cpu_self()->id;
+	}
+}
+
+/*
+ * Release the kernel lock.
+ * Interrupts must be disabled.
+ */
+void smp_unlock_kernel(void)
+{
+	if (s_kernel_lock_active) {
+		KASSERT(s_kernel_lock_owner == cpu_self()->id);
+		s_kernel_lock_owner = -1;
+		spin_unlock(&s_kernel_lock);
+	}
+}
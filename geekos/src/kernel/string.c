@@ -21,11 +21,16 @@
 #include <geekos/string.h>
 #include <geekos/types.h>
 #include <geekos/mem.h>
+#include <geekos/cons.h>
+#include <geekos/timer.h>
+#include <arch/string.h>
 
 /*
- * TODO: these could be speeded up with architecture-specific implementations
+ * Generic versions of memcpy() and memset(), for architectures
+ * that don't provide optimized versions.
  */
 
+#ifndef ARCH_HAVE_MEMCPY
 void memcpy(void *dst, const void *src, size_t n)
 {
 	u8_t *d = dst;
@@ -36,7 +41,9 @@ void memcpy(void *dst, const void *src, size_t n)
 		--n;
 	}
 }
+#endif
 
+#ifndef ARCH_HAVE_MEMSET
 void memset(void *buf, int c, size_t n)
 {
 	u8_t *d = buf;
@@ -46,6 +53,7 @@ void memset(void *buf, int c, size_t n)
 		--n;
 	}
 }
+#endif
 
 size_t strlen(const char *s)
 {
@@ -118,3 +126,65 @@ char *strdup(const char *s)
 	return dup;
 }
 #endif
+
+/* ----------------------------------------------------------------------
+ * Benchmarks
+ * ---------------------------------------------------------------------- */
+
+#define STRING_BENCH_MAX_SIZE   (1024 * 1024)
+#define STRING_BENCH_ORDER      9  /* 2 MB: source and destination buffers */
+#define STRING_BENCH_TOTAL_SHIFT 23 /* each measurement moves 8 MB */
+#define STRING_BENCH_TOTAL_SIZE (1UL << STRING_BENCH_TOTAL_SHIFT)
+
+/* buffer sizes to measure */
+static const size_t s_string_bench_sizes[] = {
+	8, 64, 512, 4096, 65536, STRING_BENCH_MAX_SIZE,
+};
+
+/*
+ * Measure memcpy() and memset() throughput for buffer sizes
+ * from 8 bytes to 1 MB.
+ */
+void string_benchmark(void)
+{
+	struct frame *frames;
+	char *src, *dst;
+	size_t size;
+	u32_t i, j, num_iters;
+	u64_t start, copy_cycles, set_cycles;
+
+	cons_printf("memcpy/memset benchmark:\n");
+
+	frames = mem_alloc_frames(FRAME_KERN, 0, STRING_BENCH_ORDER);
+	if (frames == 0) {
+		cons_printf("  skipped (not enough contiguous memory)\n");
+		return;
+	}
+	src = mem_frame_to_pa(frames);
+	dst = src + STRING_BENCH_MAX_SIZE;
+	memset(src, 'x', STRING_BENCH_MAX_SIZE);
+
+	for (j = 0; j < sizeof(s_string_bench_sizes) / sizeof(s_string_bench_sizes[0]); j++) {
+		/* every measurement moves the same total number of bytes */
+		size = s_string_bench_sizes[j];
+		num_iters = STRING_BENCH_TOTAL_SIZE / size;
+
+		start = timer_read_cycles();
+		for (i = 0; i < num_iters; i++) {
+			memcpy(dst, src, size);
+		}
+		copy_cycles = timer_read_cycles() - start;
+
+		start = timer_read_cycles();
+		for (i = 0; i < num_iters; i++) {
+			memset(dst, i, size);
+		}
+		set_cycles = timer_read_cycles() - start;
+
+		cons_printf("  %lu bytes: memcpy %lu, memset %lu cycles per KB\n", (ulong_t) size,
+			(u32_t) (copy_cycles >> (STRING_BENCH_TOTAL_SHIFT - 10)),
+			(u32_t) (set_cycles >> (STRING_BENCH_TOTAL_SHIFT - 10)));
+	}
+
+	mem_free_frames(frames, STRING_BENCH_ORDER);
+}
@@ -21,6 +21,12 @@
 #include <geekos/synch.h>
 #include <geekos/int.h>
 #include <geekos/kassert.h>
+#include <geekos/timer.h>
+#include <geekos/errno.h>
+#include <geekos/string.h>
+#include <geekos/cons.h>
+#include <geekos/smp.h>
+#include <arch/atomic.h>
 
 /*
  * NOTES:
@@ -37,52 +43,181 @@
  * ---------------------------------------------------------------------- */
 
 /*
- * Lock given mutex.
- * Preemption must be disabled.
+ * Lock given mutex if it is unlocked, without waiting.
+ * Does not need the kernel lock.
+ */
+static __inline__ bool mutex_try_acquire(struct mutex *mutex)
+{
+	return atomic_cmpxchg(&mutex->state, MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED;
+}
+
+/*
+ * Return true if given mutex owner is running on a CPU.
+ * Called without the kernel lock, so this is only a hint:
+ * the owner may stop running at any time.
+ */
+static __inline__ bool mutex_owner_running(struct thread *owner)
+{
+	return owner->state == THREAD_RUNNING && g_cpus[owner->cpu].current == owner;
+}
+
+/*
+ * A contended mutex is likely to be released soon if its
+ * owner is running on another CPU, so it is cheaper to spin
+ * for a while than to wait (which costs two context switches).
+ * Returns true if the mutex was acquired by spinning,
+ * false if the caller should wait.
+ * Interrupts must be enabled.
+ */
+static bool mutex_spin(struct mutex *mutex)
+{
+	struct thread *owner;
+	int i;
+
+	if (g_num_cpus == 1) {
+		/* the owner can't be running */
+		return false;
+	}
+
+	for (i = 0; i < MUTEX_SPIN_LIMIT; i++) {
+		/* owner is briefly null while the mutex changes hands */
+		owner = mutex->owner;
+		if (owner != 0 && !mutex_owner_running(owner)) {
+			return false;
+		}
+		if (mutex->state == MUTEX_UNLOCKED && mutex_try_acquire(mutex)) {
+			return true;
+		}
+		cpu_relax();
+	}
+	return false;
+}
+
+/*
+ * Lock given mutex, waiting if it is held.
+ * Interrupts must be disabled.  (On a multiprocessor, disabling
+ * preemption would not keep threads on other CPUs out.)
  */
 static __inline__ void mutex_lock_imp(struct mutex *mutex)
 {
-	KASSERT(!g_preemption);
+	KASSERT(!int_enabled());
 
 	/* Make sure we're not already holding the mutex */
 	KASSERT(!MUTEX_IS_HELD(mutex));
 
-	/* wait until the mutex is in an unlocked state */
-	while (mutex->state == MUTEX_LOCKED) {
-		thread_park(&mutex->waitqueue);
+	/*
+	 * Wait until the mutex is in an unlocked state.
+	 * Marking it contended guarantees that its owner will wake us:
+	 * since we hold the kernel lock, the owner can't
+	 * wake up waiters until we are in the wait queue.
+	 */
+	while (atomic_xchg(&mutex->state, MUTEX_CONTENDED) != MUTEX_UNLOCKED) {
+		thread_wait(&mutex->waitqueue);
 	}
 
 	/* Now it's ours! */
-	mutex->state = MUTEX_LOCKED;
 	mutex->owner = g_current;
 }
 
 /*
  * Unlock given mutex.
- * Preemption must be disabled.
  */
 static __inline__ void mutex_unlock_imp(struct mutex *mutex)
 {
-	KASSERT(!g_preemption);
+	bool iflag;
 
 	/* Make sure mutex was actually acquired by this thread. */
 	KASSERT(MUTEX_IS_HELD(mutex));
 
 	/* unlock the mutex. */
-	mutex->state = MUTEX_UNLOCKED;
 	mutex->owner = 0;
 
-	/*
-	 * If there are threads waiting to acquire the mutex,
-	 * wake one of them up.  Note that it is legal to inspect
-	 * the queue with interrupts enabled because preemption
-	 * is disabled, and therefore we know that no thread can
-	 * concurrently add itself to the queue.
-	 */
-	if (!thread_queue_is_empty(&mutex->waitqueue)) {
-		int_disable();
+	/* If there may be threads waiting to acquire the mutex, wake one of them up. */
+	if (atomic_xchg(&mutex->state, MUTEX_UNLOCKED) == MUTEX_CONTENDED) {
+		iflag = int_begin_atomic();
 		thread_wakeup_one(&mutex->waitqueue);
-		int_enable();
+		int_end_atomic(iflag);
+	}
+}
+
+/*
+ * Read-lock given rwlock if no writer holds it and no thread
+ * is waiting for it, without waiting.
+ * Does not need the kernel lock.
+ */
+static bool rwlock_try_read(struct rwlock *rwlock)
+{
+	u32_t state;
+
+	for (;;) {
+		state = rwlock->state;
+		if ((state & (RWLOCK_WRITER | RWLOCK_WAITERS)) != 0) {
+			return false;
+		}
+		if (atomic_cmpxchg(&rwlock->state, state, state + 1) == state) {
+			return true;
+		}
+	}
+}
+
+/*
+ * Write-lock given rwlock if it is free, without waiting.
+ * Does not need the kernel lock.
+ */
+static __inline__ bool rwlock_try_write(struct rwlock *rwlock)
+{
+	return atomic_cmpxchg(&rwlock->state, 0, RWLOCK_WRITER) == 0;
+}
+
+/*
+ * Wait until given rwlock can be acquired for reading or writing.
+ * Interrupts must be disabled.  Before waiting, the waiters bit
+ * is set while the lock is observed held, so the release that
+ * frees the lock will see it and wake this thread up.
+ */
+static void rwlock_wait(struct rwlock *rwlock, bool write)
+{
+	u32_t state;
+
+	KASSERT(!int_enabled());
+
+	for (;;) {
+		state = rwlock->state;
+		if (state == 0 || (!write && (state & (RWLOCK_WRITER | RWLOCK_WAITERS)) == 0)) {
+			/* lock looks available: try to take it */
+			if (atomic_cmpxchg(&rwlock->state, state, write ? RWLOCK_WRITER : state + 1) == state) {
+				return;
+			}
+		} else if ((state & RWLOCK_WAITERS) != 0
+			   || atomic_cmpxchg(&rwlock->state, state, state | RWLOCK_WAITERS) == state) {
+			/* the releasing thread will wake us */
+			thread_wait(&rwlock->waitqueue);
+		}
+	}
+}
+
+/*
+ * Release one hold on given rwlock (the writer's, or one reader's).
+ * If that frees the lock and there are waiters, wake them all;
+ * they compete for the lock again.
+ */
+static void rwlock_release(struct rwlock *rwlock, bool write)
+{
+	u32_t state, new_state;
+	bool iflag;
+
+	do {
+		state = rwlock->state;
+		new_state = write ? (state & ~RWLOCK_WRITER) : state - 1;
+		if ((new_state & (RWLOCK_WRITER | RWLOCK_READERS)) == 0) {
+			new_state = 0;
+		}
+	} while (atomic_cmpxchg(&rwlock->state, state, new_state) != state);
+
+	if (new_state == 0 && (state & RWLOCK_WAITERS) != 0) {
+		iflag = int_begin_atomic();
+		thread_wakeup(&rwlock->waitqueue);
+		int_end_atomic(iflag);
 	}
 }
 
@@ -95,21 +230,59 @@ static __inline__ void mutex_unlock_imp(struct mutex *mutex)
  */
 void mutex_init(struct mutex *mutex)
 {
+	memset(mutex, '\0', sizeof(struct mutex));
 	mutex->state = MUTEX_UNLOCKED;
-	mutex->owner = 0;
 	thread_queue_clear(&mutex->waitqueue);
 }
 
 /*
  * Lock given mutex.
+ * If the mutex is held by a thread running on another CPU,
+ * spin briefly before waiting.
  */
 void mutex_lock(struct mutex *mutex)
 {
+	u64_t start;
+
 	KASSERT(int_enabled());
+	KASSERT(!MUTEX_IS_HELD(mutex));
 
-	g_preemption = false;
-	mutex_lock_imp(mutex);
-	g_preemption = true;
+	if (mutex_try_acquire(mutex)) {
+		mutex->owner = g_current;
+	} else {
+		start = timer_read_cycles();
+		if (mutex_spin(mutex)) {
+			mutex->owner = g_current;
+			mutex->num_spun++;
+		} else {
+			int_disable();
+			mutex_lock_imp(mutex);
+			int_enable();
+		}
+		mutex->num_contended++;
+		mutex->wait_cycles += timer_read_cycles() - start;
+	}
+
+	/* the statistics are protected by the mutex itself */
+	mutex->num_acquired++;
+}
+
+/*
+ * Attempt to lock given mutex without waiting.
+ * Returns true if the mutex was acquired, false if
+ * it is held by another thread.
+ */
+bool mutex_trylock(struct mutex *mutex)
+{
+	KASSERT(int_enabled());
+	KASSERT(!MUTEX_IS_HELD(mutex));
+
+	if (!mutex_try_acquire(mutex)) {
+		return false;
+	}
+	mutex->owner = g_current;
+	mutex->num_acquired++;
+	return true;
 }
 
 /*
@@ -119,9 +292,109 @@ void mutex_unlock(struct mutex *mutex)
 {
 	KASSERT(int_enabled());
 
-	g_preemption = false;
 	mutex_unlock_imp(mutex);
-	g_preemption = true;
+}
+
+/*
+ * Print contention statistics of given mutex.
+ * Cycle counts are in units of 1024 cycles.
+ */
+void mutex_dump_stats(struct mutex *mutex, const char *name)
+{
+	cons_printf("%s: %lu acquired, %lu contended, %lu spun, %lu Kcycles waiting\n",
+		name, (ulong_t) mutex->num_acquired, (ulong_t) mutex->num_contended,
+		(ulong_t) mutex->num_spun, (ulong_t) (mutex->wait_cycles >> 10));
+}
+
+/*
+ * Initialize given rwlock.
+ */
+void rwlock_init(struct rwlock *rwlock)
+{
+	memset(rwlock, '\0', sizeof(struct rwlock));
+	thread_queue_clear(&rwlock->waitqueue);
+}
+
+/*
+ * Lock given rwlock for reading, waiting while a writer holds it
+ * or while other threads are waiting for it.
+ */
+void rwlock_read_lock(struct rwlock *rwlock)
+{
+	KASSERT(int_enabled());
+	KASSERT(!RWLOCK_IS_WRITE_HELD(rwlock));
+
+	if (!rwlock_try_read(rwlock)) {
+		int_disable();
+		rwlock_wait(rwlock, false);
+		int_enable();
+		atomic_fetch_add(&rwlock->num_read_contended, 1);
+	}
+
+	/* readers share the lock, so their statistics are updated atomically */
+	atomic_fetch_add(&rwlock->num_read_acquired, 1);
+}
+
+/*
+ * Release a read lock on given rwlock.
+ */
+void rwlock_read_unlock(struct rwlock *rwlock)
+{
+	KASSERT(int_enabled());
+	KASSERT(RWLOCK_IS_READ_HELD(rwlock));
+
+	rwlock_release(rwlock, false);
+}
+
+/*
+ * Lock given rwlock for writing, waiting until
+ * no other thread holds it.
+ */
+void rwlock_write_lock(struct rwlock *rwlock)
+{
+	u64_t start;
+
+	KASSERT(int_enabled());
+	KASSERT(!RWLOCK_IS_WRITE_HELD(rwlock));
+
+	if (rwlock_try_write(rwlock)) {
+		rwlock->writer = g_current;
+	} else {
+		start = timer_read_cycles();
+		int_disable();
+		rwlock_wait(rwlock, true);
+		int_enable();
+		rwlock->writer = g_current;
+		rwlock->num_write_contended++;
+		rwlock->write_wait_cycles += timer_read_cycles() - start;
+	}
+
+	/* the writer statistics are protected by the write lock */
+	rwlock->num_write_acquired++;
+}
+
+/*
+ * Release the write lock on given rwlock.
+ */
+void rwlock_write_unlock(struct rwlock *rwlock)
+{
+	KASSERT(int_enabled());
+	KASSERT(RWLOCK_IS_WRITE_HELD(rwlock));
+
+	rwlock->writer = 0;
+	rwlock_release(rwlock, true);
+}
+
+/*
+ * Print contention statistics of given rwlock.
+ * Cycle counts are in units of 1024 cycles.
+ */
+void rwlock_dump_stats(struct rwlock *rwlock, const char *name)
+{
+	cons_printf("%s: %lu read (%lu contended), %lu written (%lu contended), %lu Kcycles writers waiting\n",
+		name, (ulong_t) rwlock->num_read_acquired, (ulong_t) rwlock->num_read_contended,
+		(ulong_t) rwlock->num_write_acquired, (ulong_t) rwlock->num_write_contended,
+		(ulong_t) (rwlock->write_wait_cycles >> 10));
 }
 
 /*
@@ -142,31 +415,54 @@ void cond_wait(struct condition *cond, struct mutex *mutex)
 	/* Ensure mutex is held. */
 	KASSERT(MUTEX_IS_HELD(mutex));
 
-	/* Turn off scheduling. */
-	g_preemption = false;
+	/* Turn off interrupts (and scheduling). */
+	int_disable();
 
 	/*
-	 * Release the mutex, but leave preemption disabled.
-	 * No other threads will be able to run before this thread
-	 * is able to wait.  Therefore, this thread will not
-	 * miss the eventual notification on the condition.
+	 * Release the mutex, but leave interrupts disabled.
+	 * No other thread will be able to signal the condition
+	 * before this thread is able to wait.  Therefore, this thread
+	 * will not miss the eventual notification on the condition.
 	 */
 	mutex_unlock_imp(mutex);
 
 	/*
-	 * Atomically reenable preemption and wait in the condition wait queue.
+	 * Wait in the condition wait queue.
 	 * Other threads can run while this thread is waiting,
 	 * and eventually one of them will call cond_signal() or cond_broadcast()
 	 * to wake up this thread.
-	 * On wakeup, preemption is once again disabled.
+	 * On wakeup, interrupts are once again disabled.
 	 */
-	thread_park(&cond->waitqueue);
+	thread_wait(&cond->waitqueue);
 
 	/* Reacquire the mutex. */
 	mutex_lock_imp(mutex);
 
-	/* Turn scheduling back on. */
-	g_preemption = true;
+	/* Turn interrupts back on. */
+	int_enable();
+}
+
+/*
+ * Wait on given condition (protected by given mutex),
+ * giving up after given number of nanoseconds.
+ * The mutex is held again on return in either case.
+ * Returns 0 if the condition was signaled, or ETIMEDOUT.
+ */
+int cond_timedwait(struct condition *cond, struct mutex *mutex, u64_t timeout_ns)
+{
+	bool woken;
+
+	KASSERT(int_enabled());
+	KASSERT(MUTEX_IS_HELD(mutex));
+
+	/* as in cond_wait() */
+	int_disable();
+	mutex_unlock_imp(mutex);
+	woken = thread_wait_timeout(&cond->waitqueue, timer_ns_to_ticks(timeout_ns));
+	mutex_lock_imp(mutex);
+	int_enable();
+
+	return woken ? 0 : ETIMEDOUT;
 }
 
 /*
@@ -24,7 +24,11 @@
 #include <geekos/kassert.h>
 #include <geekos/int.h>
 #include <geekos/mem.h>
+#include <geekos/slab.h>
 #include <geekos/workqueue.h>
+#include <geekos/timer.h>
+#include <geekos/smp.h>
+#include <geekos/errno.h>
 
 /*-----------------------------------------------------------------------
  * Implementation
@@ -34,37 +38,282 @@ IMPLEMENT_LIST_CLEAR(thread_queue, thread)
 IMPLEMENT_LIST_IS_EMPTY(thread_queue, thread)
 IMPLEMENT_LIST_APPEND(thread_queue, thread)
 IMPLEMENT_LIST_REMOVE_FIRST(thread_queue, thread)
+IMPLEMENT_LIST_REMOVE(thread_queue, thread)
+IMPLEMENT_LIST_GET_FIRST(thread_queue, thread)
+IMPLEMENT_LIST_GET_LAST(thread_queue, thread)
+IMPLEMENT_LIST_NEXT(thread_queue, thread)
+IMPLEMENT_LIST_PREV(thread_queue, thread)
 
-static struct thread_queue s_runqueue;
+IMPLEMENT_LIST_APPEND(thread_list, thread)
+IMPLEMENT_LIST_REMOVE(thread_list, thread)
+IMPLEMENT_LIST_GET_FIRST(thread_list, thread)
+IMPLEMENT_LIST_NEXT(thread_list, thread)
 
 /*
- * Idle thread; ensures that at least one thread is
- * always running or runnable.
+ * Scheduling is a multi-level feedback queue:
+ * - There is one FIFO run queue per priority, and a bitmap
+ *   of the non-empty queues, so picking the most important
+ *   runnable thread takes constant time.
+ * - A thread that uses up its quantum drops one priority level
+ *   (but never to the idle priority).  A thread that blocks
+ *   returns to its base priority, so interactive and I/O-bound
+ *   threads stay ahead of compute-bound threads.
+ * - Every TIMER_BOOST_INTERVAL ticks, all runnable threads
+ *   return to their base priority, so decayed threads can't starve.
+ * - When a thread more important than the current thread becomes
+ *   runnable, the current thread is preempted.
+ * - Each CPU has its own set of run queues.  A new thread is
+ *   placed on the least loaded CPU; a thread that wakes up
+ *   returns to the CPU it last ran on.
+ * - A CPU whose run queues are empty steals a thread from the
+ *   CPU with the most ready threads.  The owner takes threads
+ *   from the front of its queues, thieves take them from the back,
+ *   since the threads there have waited longest and are least
+ *   likely to have data in the victim's cache.
+ * - A thread only runs on the CPUs in its affinity mask.
  */
-static void thread_idle(ulong_t arg)
-{
-	while (true) {
-		thread_yield();
-	}
-	/* does not return */
-}
+struct runqueue {
+	struct thread_queue queues[THREAD_NUM_PRIORITIES];
+	u32_t bitmap;
+	int num_ready;
+
+	/* statistics */
+	u32_t num_steals;       /* threads stolen by this CPU */
+	u32_t num_migrations;   /* threads moved to this CPU */
+};
+
+static struct runqueue s_runqueues[CPU_MAX];
+
+/*
+ * Each CPU's idle thread is never on a run queue: it is chosen
+ * only when all of the CPU's run queues are empty.
+ */
+
+/* all threads that have not been destroyed, for statistics */
+static struct thread_list s_all_threads;
+
+/* total number of context switches */
+static u32_t s_num_switches;
+
+static struct slab_cache s_thread_cache = SLAB_CACHE_INITIALIZER("thread", sizeof(struct thread));
 
 /*#define DEBUG_RUNQUEUE*/
 
 #ifdef DEBUG_RUNQUEUE
 static void thread_dump_runnable(void)
 {
+	struct runqueue *rq = &s_runqueues[cpu_self()->id];
 	struct thread *thread;
+	int prio;
 	cons_printf("runqueue:");
-	for (thread = thread_queue_get_first(&s_runqueue);
-	     thread != 0;
-	     thread = thread_queue_next(thread)) {
-		cons_printf(" [%p]", thread);
+	for (prio = 0; prio < THREAD_NUM_PRIORITIES; prio++) {
+		for (thread = thread_queue_get_first(&rq->queues[prio]);
+		     thread != 0;
+		     thread = thread_queue_next(thread)) {
+			cons_printf(" [%p:%d]", thread, prio);
+		}
 	}
 	cons_printf("\n");
 }
 #endif
 
+/*
+ * Add a thread to the run queue of its CPU for its current priority.
+ * Interrupts must be disabled.
+ */
+static void thread_runqueue_add(struct thread *thread)
+{
+	struct runqueue *rq = &s_runqueues[thread->cpu];
+
+	KASSERT(!int_enabled());
+	thread_queue_append(&rq->queues[thread->priority], thread);
+	rq->bitmap |= 1UL << thread->priority;
+	rq->num_ready++;
+}
+
+/*
+ * Remove a thread from the run queue of its CPU for its current priority.
+ * Interrupts must be disabled.
+ */
+static void thread_runqueue_remove(struct thread *thread)
+{
+	struct runqueue *rq = &s_runqueues[thread->cpu];
+
+	KASSERT(!int_enabled());
+	thread_queue_remove(&rq->queues[thread->priority], thread);
+	if (thread_queue_is_empty(&rq->queues[thread->priority])) {
+		rq->bitmap &= ~(1UL << thread->priority);
+	}
+	rq->num_ready--;
+}
+
+/*
+ * Choose a CPU for a thread with given affinity mask: the
+ * online CPU in the mask with the fewest threads running or
+ * ready to run.  Returns -1 if no CPU in the mask is online.
+ * Interrupts must be disabled.
+ */
+static int thread_pick_cpu(u32_t affinity)
+{
+	int i, load, best = -1, best_load = 0;
+
+	KASSERT(!int_enabled());
+
+	for (i = 0; i < CPU_MAX; i++) {
+		if (!g_cpus[i].online || !(affinity & (1UL << i))) {
+			continue;
+		}
+		load = s_runqueues[i].num_ready + (thread_is_idle(g_cpus[i].current) ? 0 : 1);
+		if (best < 0 || load < best_load) {
+			best = i;
+			best_load = load;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Move a thread that is not on a run queue to given CPU.
+ */
+static void thread_migrate(struct thread *thread, int cpu_id)
+{
+	KASSERT(cpu_id >= 0 && cpu_id < CPU_MAX);
+	KASSERT(thread->affinity & (1UL << cpu_id));
+	if (thread->cpu != cpu_id) {
+		thread->cpu = cpu_id;
+		thread->num_migrations++;
+		s_runqueues[cpu_id].num_migrations++;
+	}
+}
+
+/*
+ * Make given CPU choose a new thread as soon as possible.
+ * Interrupts must be disabled.
+ */
+static void thread_kick_cpu(struct cpu *cpu)
+{
+	cpu->need_reschedule = 1;
+	if (cpu != cpu_self()) {
+		smp_send_reschedule(cpu);
+	}
+}
+
+/*
+ * Preempt the current thread of given thread's CPU
+ * if given thread is more important.
+ * Returns true if the CPU will be preempted.
+ * Interrupts must be disabled.
+ */
+static bool thread_check_preemption(struct thread *thread)
+{
+	struct cpu *cpu = &g_cpus[thread->cpu];
+
+	KASSERT(!int_enabled());
+
+	if (thread != cpu->current && thread->priority < cpu->current->priority) {
+		thread_kick_cpu(cpu);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Wake up an idle CPU that could steal given ready thread,
+ * rather than leaving the thread to wait for its own CPU.
+ * Interrupts must be disabled.
+ */
+static void thread_kick_idle_cpu(struct thread *thread)
+{
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		if (i != thread->cpu && g_cpus[i].online && (thread->affinity & (1UL << i))
+		    && thread_is_idle(g_cpus[i].current) && !g_cpus[i].need_reschedule) {
+			thread_kick_cpu(&g_cpus[i]);
+			break;
+		}
+	}
+}
+
+/*
+ * Find the last thread in the most important non-empty queue
+ * of given run queue that is allowed to run on given CPU.
+ */
+static struct thread *thread_runqueue_find_steal(struct runqueue *rq, int cpu_id)
+{
+	struct thread *thread;
+	int prio;
+
+	for (prio = 0; prio < THREAD_NUM_PRIORITIES; prio++) {
+		for (thread = thread_queue_get_last(&rq->queues[prio]);
+		     thread != 0;
+		     thread = thread_queue_prev(thread)) {
+			if (thread->affinity & (1UL << cpu_id)) {
+				return thread;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find a ready thread that given CPU could steal from
+ * the CPU with the most ready threads.
+ * Returns 0 if there is no such thread.
+ * Interrupts must be disabled.
+ */
+static struct thread *thread_find_steal(int cpu_id)
+{
+	struct thread *thread, *found = 0;
+	int i, found_load = 0;
+
+	KASSERT(!int_enabled());
+
+	for (i = 0; i < CPU_MAX; i++) {
+		if (i == cpu_id || !g_cpus[i].online || s_runqueues[i].num_ready <= found_load) {
+			continue;
+		}
+		thread = thread_runqueue_find_steal(&s_runqueues[i], cpu_id);
+		if (thread != 0) {
+			found = thread;
+			found_load = s_runqueues[i].num_ready;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Idle thread; ensures that at least one thread is
+ * always running or runnable.
+ * Uses its time slices to zero free frames in advance.
+ */
+static void thread_idle(ulong_t arg)
+{
+	int cpu_id = g_current->cpu;
+	struct runqueue *rq = &s_runqueues[cpu_id];
+
+	while (true) {
+		mem_refill_zero_pool();
+
+		int_disable();
+		if (rq->bitmap == 0 && thread_find_steal(cpu_id) == 0) {
+			/*
+			 * Nothing to do: halt until an interrupt arrives.
+			 * If the interrupt makes a thread runnable, it will
+			 * preempt this thread on return from the interrupt.
+			 */
+			int_wait();
+		} else {
+			/* a thread became runnable (here or on a busy CPU) while preemption was disabled */
+			int_enable();
+			thread_yield();
+		}
+	}
+	/* does not return */
+}
+
 /*
  * Workqueue callback function to free resources used by
  * a thread that has exited or been killed.
@@ -72,15 +321,20 @@ static void thread_dump_runnable(void)
 static void thread_destroy(void *thread_)
 {
 	struct thread *thread = thread_;
+	bool iflag;
 
 	KASSERT(thread->state == THREAD_EXITED || thread->state == THREAD_KILLED);
 
 	/*cons_printf("destroying thread %p\n", thread);*/
 
+	iflag = int_begin_atomic();
+	thread_list_remove(&s_all_threads, thread);
+	int_end_atomic(iflag);
+
 	/* TODO: user space teardown */
 
 	mem_free_frame(mem_pa_to_frame(thread->stack));
-	mem_free(thread);
+	slab_free(&s_thread_cache, thread);
 }
 
 /*
@@ -105,10 +359,6 @@ static void thread_detach(struct thread *thread)
  * Interface
  *----------------------------------------------------------------------- */
 
-struct thread *g_current;
-volatile int g_need_reschedule;
-volatile int g_preemption;
-
 /*
  * Bootstrap main thread, initialize scheduler.
  */
@@ -118,40 +368,117 @@ void thread_init(void)
 
 	KASSERT(g_current == 0);
 	KASSERT(g_need_reschedule == 0);
-	KASSERT(g_preemption == false);
-	KASSERT(thread_queue_is_empty(&s_runqueue));
 	KASSERT(THREAD_CONTEXT_SIZE == sizeof(struct thread_context));
 	KASSERT(THREAD_STACK_PTR_OFFSET == OFFSETOF(struct thread, stack_ptr));
+	KASSERT(THREAD_PREEMPTION_OFFSET == OFFSETOF(struct thread, preemption));
+	KASSERT(CPU_SELF_OFFSET == OFFSETOF(struct cpu, self));
+	KASSERT(CPU_CURRENT_OFFSET == OFFSETOF(struct cpu, current));
+	KASSERT(CPU_NEED_RESCHEDULE_OFFSET == OFFSETOF(struct cpu, need_reschedule));
 
 	/* bootstrap main thread */
-	main_thread = (struct thread *) mem_alloc(sizeof(struct thread));
+	main_thread = slab_alloc(&s_thread_cache);
 	memset(main_thread, '\0', sizeof(struct thread));
 	main_thread->stack = (void *) KERN_STACK;
 	main_thread->state = THREAD_RUNNING;
 	main_thread->refcount = 1;
-	g_current = main_thread;
+	main_thread->base_priority = main_thread->priority = THREAD_PRIORITY_DEFAULT;
+	main_thread->affinity = THREAD_AFFINITY_ALL;
+	main_thread->switch_cycles = timer_read_cycles();
+	thread_list_append(&s_all_threads, main_thread);
+	cpu_set_current(main_thread);
 
 	/* create idle thread */
-	thread_create(thread_idle, 0UL, THREAD_DETACHED);
+	thread_create_idle(cpu_self());
 }
 
 /*
- * Create and start a new kernel-only thread.
+ * Create the idle thread of given CPU.
+ * It is not placed on a run queue: the bootstrap processor
+ * switches to its idle thread when it has nothing else to run,
+ * and application processors start out running their idle
+ * threads (see thread_start_cpu()).
+ */
+struct thread *thread_create_idle(struct cpu *cpu)
+{
+	struct thread *thread;
+	bool iflag;
+
+	thread = slab_alloc(&s_thread_cache);
+	memset(thread, '\0', sizeof(struct thread));
+	thread->stack = mem_frame_to_pa(mem_alloc_frame(FRAME_KSTACK, 0));
+	thread->preemption = true;
+	thread->state = THREAD_READY;
+	thread->refcount = 1;
+	thread->base_priority = thread->priority = THREAD_PRIORITY_IDLE;
+	thread->cpu = cpu->id;
+	thread->affinity = 1UL << cpu->id;
+	thread_bootstrap(thread, thread_idle, 0UL);
+
+	iflag = int_begin_atomic();
+	thread_list_append(&s_all_threads, thread);
+	cpu->idle_thread = thread;
+	int_end_atomic(iflag);
+
+	return thread;
+}
+
+/*
+ * Start scheduling threads on the calling application processor.
+ * Called with interrupts disabled, on the stack of the CPU's
+ * idle thread, which becomes the current thread.
+ */
+void thread_start_cpu(void)
+{
+	struct cpu *cpu = cpu_self();
+	struct thread *idle = cpu->idle_thread;
+
+	KASSERT(!int_enabled());
+	smp_lock_kernel();
+
+	cpu_set_current(idle);
+	idle->state = THREAD_RUNNING;
+	idle->switch_cycles = timer_read_cycles();
+	cpu->online = true;
+	g_num_cpus++;
+
+	int_enable();
+	thread_idle(0UL);
+
+	/* Convince gcc that this is a noreturn function. */
+	while (true);
+}
+
+/*
+ * Create and start a new kernel-only thread with the default priority.
  * Returns a pointer to the new kernel thread, or 0 if
  * there is not enough memory to create the new thread.
  */
 struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode_t mode)
+{
+	return thread_create_priority(start_func, arg, mode, THREAD_PRIORITY_DEFAULT);
+}
+
+/*
+ * Create and start a new kernel-only thread with given priority.
+ */
+struct thread *thread_create_priority(thread_func_t *start_func, ulong_t arg, thread_mode_t mode, int priority)
 {
 	struct thread *thread;
 	void *stack;
+	bool iflag;
 
-	thread = mem_alloc(sizeof(struct thread));
+	KASSERT(priority >= 0 && priority < THREAD_NUM_PRIORITIES);
+
+	thread = slab_alloc(&s_thread_cache);
 	stack = mem_frame_to_pa(mem_alloc_frame(FRAME_KSTACK, 0));
 
 	/* initialize the thread */
 	memset(thread, '\0', sizeof(struct thread));
 	thread->stack = stack;
+	thread->preemption = true;
 	thread->refcount = 1; /* each thread has an implicit self-reference */
+	thread->base_priority = thread->priority = priority;
+	thread->affinity = THREAD_AFFINITY_ALL;
 	if (mode == THREAD_ATTACHED) {
 		/* parent (current thread) holds a reference */
 		thread->parent = g_current;
@@ -161,7 +488,11 @@ struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode
 	/* start it running */
 	thread_bootstrap(thread, start_func, arg);
 	KASSERT(thread->stack_ptr != 0);
+	iflag = int_begin_atomic();
+	thread->cpu = thread_pick_cpu(thread->affinity);
+	thread_list_append(&s_all_threads, thread);
 	thread_make_runnable(thread);
+	int_end_atomic(iflag);
 	return thread;
 }
 
@@ -233,10 +564,53 @@ void thread_wait(struct thread_queue *queue)
 {
 	KASSERT(!int_enabled());
 	thread_relinquish_cpu();
+	g_current->num_voluntary++;
+
+	/* blocking before the quantum ran out: restore base priority */
+	g_current->priority = g_current->base_priority;
+
+	g_current->state = THREAD_WAITING;
+	g_current->waiting_on = queue;
 	thread_queue_append(queue, g_current);
 	thread_schedule();
 }
 
+/*
+ * Timer event function to end a timed wait.
+ */
+static void thread_wait_expired(void *thread_)
+{
+	struct thread *thread = thread_;
+
+	if (thread->waiting_on != 0) {
+		thread_queue_remove(thread->waiting_on, thread);
+		thread->waiting_on = 0;
+		thread->timed_out = true;
+		thread_make_runnable(thread);
+	}
+}
+
+/*
+ * Like thread_wait(), but give up waiting after
+ * given number of ticks.
+ * Returns true if the thread was woken up,
+ * false if the wait timed out.
+ */
+bool thread_wait_timeout(struct thread_queue *queue, u32_t num_ticks)
+{
+	struct timer_event timeout;
+
+	KASSERT(!int_enabled());
+
+	g_current->timed_out = false;
+	timer_event_init(&timeout, &thread_wait_expired, g_current);
+	timer_event_add(&timeout, num_ticks);
+	thread_wait(queue);
+	timer_event_cancel(&timeout);
+
+	return !g_current->timed_out;
+}
+
 /*
  * Park current thread in given thread queue.
  * Interrupts must be enabled, but preemption must be disabled.
@@ -252,6 +626,36 @@ void thread_park(struct thread_queue *queue)
 	int_enable();
 }
 
+/*
+ * Like thread_park(), but give up waiting after
+ * given number of ticks.
+ * Returns true if the thread was woken up,
+ * false if the wait timed out.
+ */
+bool thread_park_timeout(struct thread_queue *queue, u32_t num_ticks)
+{
+	bool woken;
+
+	KASSERT(!g_preemption);
+
+	int_disable();
+	g_preemption = true;
+	woken = thread_wait_timeout(queue, num_ticks);
+	g_preemption = false;
+	int_enable();
+
+	return woken;
+}
+
+/*
+ * Suspend the current thread for (at least) given number of nanoseconds.
+ * The actual resolution is one tick.
+ */
+void thread_sleep(u64_t ns)
+{
+	timer_sleep(timer_ns_to_ticks(ns));
+}
+
 /*
  * Wake up all threads waiting in given thread queue.
  */
@@ -270,6 +674,7 @@ void thread_wakeup_one(struct thread_queue *queue)
 	KASSERT(!int_enabled());
 	struct thread *thread = thread_queue_remove_first(queue);
 	if (thread) {
+		thread->waiting_on = 0;
 		/*cons_printf("waking up thread %p\n", thread);*/
 		thread_make_runnable(thread);
 	}
@@ -313,6 +718,7 @@ void thread_yield(void)
 {
 	bool iflag = int_begin_atomic();
 	thread_relinquish_cpu();
+	g_current->num_voluntary++;
 	thread_make_runnable(g_current);
 	thread_schedule();
 	int_end_atomic(iflag);
@@ -326,35 +732,278 @@ void thread_relinquish_cpu(void)
 	struct thread *thread = g_current;
 	KASSERT(thread->state == THREAD_RUNNING);
 
-	/* FIXME: sample num_ticks */
+	/* a thread that used its whole quantum drops a priority level */
+	if (thread->num_ticks > TIMER_QUANTUM && thread->priority < THREAD_PRIORITY_IDLE - 1) {
+		thread->priority++;
+	}
 	thread->num_ticks = 0;
 }
 
+/*
+ * Called from the interrupt return path when the current
+ * thread is being preempted: it gives up the CPU but
+ * remains runnable.
+ */
+void thread_preempt(void)
+{
+	KASSERT(!int_enabled());
+	thread_relinquish_cpu();
+	g_current->num_preempted++;
+	thread_make_runnable(g_current);
+}
+
 /*
  * Thread scheduler: find the next thread to run.
  */
 struct thread *thread_next_runnable(void)
 {
+	struct cpu *cpu = cpu_self();
+	struct runqueue *rq = &s_runqueues[cpu->id];
 	struct thread *next;
+	u64_t now;
 	KASSERT(!int_enabled());
 #ifdef DEBUG_RUNQUEUE
 	thread_dump_runnable();
 #endif
-	next = thread_queue_remove_first(&s_runqueue);
-	KASSERT(next);
+
+	/* charge the outgoing thread for its time on the CPU */
+	now = timer_read_cycles();
+	g_current->run_cycles += now - g_current->switch_cycles;
+	if (rq->bitmap == 0 && (next = thread_find_steal(cpu->id)) != 0) {
+		/* take a thread waiting on a busier CPU */
+		thread_runqueue_remove(next);
+		thread_migrate(next, cpu->id);
+		rq->num_steals++;
+		next->wait_cycles += now - next->ready_cycles;
+	} else if (rq->bitmap == 0) {
+		/* nothing else is runnable */
+		next = cpu->idle_thread;
+		KASSERT(next->state == THREAD_READY);
+	} else {
+		/* the lowest set bit is the most important non-empty queue */
+		next = thread_queue_get_first(&rq->queues[__builtin_ctz(rq->bitmap)]);
+		thread_runqueue_remove(next);
+		next->wait_cycles += now - next->ready_cycles;
+	}
+	if (next != g_current) {
+		next->num_switches++;
+		s_num_switches++;
+	}
+	next->switch_cycles = now;
 	next->state = THREAD_RUNNING;
 	return next;
 }
 
 /*
- * Add given thread to the runqueue.
+ * Add given thread to the runqueue of its CPU.
+ * If it is more important than the thread running on that CPU,
+ * that thread will be preempted; otherwise, an idle CPU
+ * is woken up to steal it.
  */
 void thread_make_runnable(struct thread *thread)
 {
 	bool iflag = int_begin_atomic();
 	thread->state = THREAD_READY;
-	thread_queue_append(&s_runqueue, thread);
+	thread->ready_cycles = timer_read_cycles();
+	if (thread_is_idle(thread)) {
+		goto done;
+	}
+	if (!(thread->affinity & (1UL << thread->cpu))) {
+		/* the thread's affinity changed while it was running or waiting */
+		thread_migrate(thread, thread_pick_cpu(thread->affinity));
+	}
+	thread_runqueue_add(thread);
+	if (!thread_check_preemption(thread)) {
+		thread_kick_idle_cpu(thread);
+	}
+	/*
+	 * If the current thread was running alone, its quantum
+	 * now matters: in tickless mode, the timer may be armed
+	 * for later than the quantum ends.
+	 */
+	timer_rearm();
+done:
+	int_end_atomic(iflag);
+}
+
+/*
+ * Set the base priority of given thread.
+ * The thread's current priority is reset to the new base priority.
+ */
+void thread_set_priority(struct thread *thread, int priority)
+{
+	bool iflag;
+
+	KASSERT(priority >= 0 && priority < THREAD_NUM_PRIORITIES);
+	KASSERT(!thread_is_idle(thread));
+
+	iflag = int_begin_atomic();
+	if (thread->state == THREAD_READY) {
+		thread_runqueue_remove(thread);
+		thread->base_priority = thread->priority = priority;
+		thread_runqueue_add(thread);
+		thread_check_preemption(thread);
+	} else {
+		thread->base_priority = thread->priority = priority;
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Get the base priority of given thread.
+ */
+int thread_get_priority(struct thread *thread)
+{
+	return thread->base_priority;
+}
+
+/*
+ * Set the mask of CPUs (bit n for CPU n) that given thread
+ * may run on.  If the thread is running or ready on a CPU
+ * not in the mask, it is moved.
+ * Returns 0 if successful, or EINVAL if no CPU in the mask is online.
+ */
+int thread_set_affinity(struct thread *thread, u32_t affinity)
+{
+	int rc = 0, cpu_id;
+	bool must_yield = false;
+	bool iflag;
+
+	KASSERT(!thread_is_idle(thread));
+
+	iflag = int_begin_atomic();
+
+	cpu_id = thread_pick_cpu(affinity);
+	if (cpu_id < 0) {
+		rc = EINVAL;
+		goto done;
+	}
+	thread->affinity = affinity;
+	if (affinity & (1UL << thread->cpu)) {
+		goto done;
+	}
+
+	if (thread->state == THREAD_READY) {
+		thread_runqueue_remove(thread);
+		thread_migrate(thread, cpu_id);
+		thread_runqueue_add(thread);
+		thread_check_preemption(thread);
+	} else if (thread == g_current) {
+		must_yield = true;
+	} else if (thread->state == THREAD_RUNNING) {
+		/* thread_make_runnable() moves it when it is preempted */
+		thread_kick_cpu(&g_cpus[thread->cpu]);
+	}
+	/* a waiting thread is moved when it wakes up */
+
+done:
 	int_end_atomic(iflag);
+	if (must_yield) {
+		thread_yield();
+	}
+	return rc;
+}
+
+/*
+ * Get the CPU affinity mask of given thread.
+ */
+u32_t thread_get_affinity(struct thread *thread)
+{
+	return thread->affinity;
+}
+
+/*
+ * Print per-thread scheduler statistics.
+ * Cycle counts are in units of 1024 cycles.
+ */
+void thread_dump_stats(void)
+{
+	struct thread *thread;
+	bool iflag;
+	u32_t cpu_ticks;
+	int i;
+
+	iflag = int_begin_atomic();
+
+	/* idle ticks are summed over all CPUs, so compare them with the
+	 * ticks of all CPUs (dividing first, to avoid overflow) */
+	cpu_ticks = g_numticks * g_num_cpus;
+	cons_printf("threads: %d CPUs, %lu context switches, %lu/%lu CPU ticks idle (%lu%%)\n",
+		g_num_cpus, (ulong_t) s_num_switches, (ulong_t) timer_get_idle_ticks(), (ulong_t) cpu_ticks,
+		cpu_ticks < 100 ? 0UL : (ulong_t) (timer_get_idle_ticks() / (cpu_ticks / 100)));
+	for (i = 0; i < CPU_MAX; i++) {
+		if (g_cpus[i].online) {
+			cons_printf("  cpu %d: %d ready, %lu steals, %lu migrations\n",
+				i, s_runqueues[i].num_ready, (ulong_t) s_runqueues[i].num_steals,
+				(ulong_t) s_runqueues[i].num_migrations);
+		}
+	}
+	for (thread = thread_list_get_first(&s_all_threads);
+	     thread != 0;
+	     thread = thread_list_next(thread)) {
+		cons_printf("  %p%s: cpu %d (mask %lx), state %d, prio %d/%d, %lu ticks, %lu/%lu Kcycles run/waiting, "
+			"%lu switches, %lu voluntary, %lu preempted, %lu migrations\n",
+			thread, thread == g_current ? "*" : "", thread->cpu, (ulong_t) thread->affinity, (int) thread->state,
+			thread->priority, thread->base_priority,
+			(ulong_t) thread->total_ticks,
+			(ulong_t) (thread->run_cycles >> 10), (ulong_t) (thread->wait_cycles >> 10),
+			(ulong_t) thread->num_switches, (ulong_t) thread->num_voluntary,
+			(ulong_t) thread->num_preempted, (ulong_t) thread->num_migrations);
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Return true if given thread is the idle thread.
+ */
+bool thread_is_idle(struct thread *thread)
+{
+	return thread == g_cpus[thread->cpu].idle_thread;
+}
+
+/*
+ * Return true if any thread other than the current thread
+ * and the idle thread is ready to run on the calling CPU.
+ * Interrupts must be disabled.
+ */
+bool thread_has_runnable(void)
+{
+	return s_runqueues[cpu_self()->id].bitmap != 0;
+}
+
+/*
+ * Return all runnable threads (and the current threads of
+ * all CPUs) to their base priorities.
+ * Called periodically from the timer interrupt handler.
+ */
+void thread_boost_priorities(void)
+{
+	struct runqueue *rq;
+	struct thread *thread, *next;
+	int i, prio;
+
+	KASSERT(!int_enabled());
+
+	for (i = 0; i < CPU_MAX; i++) {
+		if (!g_cpus[i].online) {
+			continue;
+		}
+		rq = &s_runqueues[i];
+
+		thread = g_cpus[i].current;
+		thread->priority = thread->base_priority;
+
+		for (prio = 0; prio < THREAD_NUM_PRIORITIES; prio++) {
+			for (thread = thread_queue_get_first(&rq->queues[prio]); thread != 0; thread = next) {
+				next = thread_queue_next(thread);
+				if (thread->priority != thread->base_priority) {
+					thread_runqueue_remove(thread);
+					thread->priority = thread->base_priority;
+					thread_runqueue_add(thread);
+				}
+			}
+		}
+	}
 }
 
 /*
@@ -20,24 +20,315 @@
 
 #include <geekos/timer.h>
 #include <geekos/thread.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
 
-/* number of ticks in one quantum */
-#define TIMER_QUANTUM 4
+/*
+ * Timer events are kept in a hierarchical timer wheel.
+ * Level 0 has one slot for each of the next TIMER_WHEEL_L0_SIZE ticks.
+ * Each slot of level n > 0 covers a whole revolution of level n-1;
+ * whenever level n-1 wraps around, the next slot of level n is
+ * "cascaded": its events are reinserted in the lower levels.
+ * Adding, cancelling and expiring an event all take constant time.
+ */
+#define TIMER_WHEEL_L0_BITS  8
+#define TIMER_WHEEL_LN_BITS  6
+#define TIMER_WHEEL_LEVELS   4
+#define TIMER_WHEEL_L0_SIZE  (1 << TIMER_WHEEL_L0_BITS)
+#define TIMER_WHEEL_LN_SIZE  (1 << TIMER_WHEEL_LN_BITS)
+#define TIMER_WHEEL_L0_MASK  (TIMER_WHEEL_L0_SIZE - 1)
+#define TIMER_WHEEL_LN_MASK  (TIMER_WHEEL_LN_SIZE - 1)
+
+/* number of bits of the tick number below level n */
+#define TIMER_WHEEL_SHIFT(n) (TIMER_WHEEL_L0_BITS + ((n) - 1) * TIMER_WHEEL_LN_BITS)
+
+/*
+ * Events further in the future are parked in the last slot of the top level.
+ * Timeouts longer than this are split: the event is re-armed for the
+ * remaining ticks when it reaches the end of the first part.
+ */
+#define TIMER_WHEEL_MAX_DELTA ((1UL << TIMER_WHEEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)
+
+IMPLEMENT_LIST_IS_EMPTY(timer_event_list, timer_event)
+IMPLEMENT_LIST_CLEAR(timer_event_list, timer_event)
+IMPLEMENT_LIST_APPEND(timer_event_list, timer_event)
+IMPLEMENT_LIST_APPEND_ALL(timer_event_list, timer_event)
+IMPLEMENT_LIST_REMOVE(timer_event_list, timer_event)
+IMPLEMENT_LIST_REMOVE_FIRST(timer_event_list, timer_event)
 
 volatile u32_t g_numticks;
 
+/* number of ticks during which the idle thread was running */
+static u32_t s_idle_ticks;
+
+static struct timer_event_list s_wheel_l0[TIMER_WHEEL_L0_SIZE];
+static struct timer_event_list s_wheel_ln[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LN_SIZE];
+
+/* next tick to be processed by the timer wheel */
+static u32_t s_wheel_tick;
+
+/*
+ * Put given event in the timer wheel slot for its expiration tick.
+ * Interrupts must be disabled.
+ */
+static void timer_wheel_insert(struct timer_event *event)
+{
+	u32_t expires = event->expires;
+	u32_t delta = expires - s_wheel_tick;
+	struct timer_event_list *slot;
+	int level;
+
+	KASSERT(!int_enabled());
+
+	if ((long) delta < 0) {
+		/* already expired: process on the next tick */
+		slot = &s_wheel_l0[s_wheel_tick & TIMER_WHEEL_L0_MASK];
+	} else if (delta < TIMER_WHEEL_L0_SIZE) {
+		slot = &s_wheel_l0[expires & TIMER_WHEEL_L0_MASK];
+	} else {
+		if (delta > TIMER_WHEEL_MAX_DELTA) {
+			/* it will be reinserted when this slot is cascaded */
+			expires = s_wheel_tick + TIMER_WHEEL_MAX_DELTA;
+			delta = TIMER_WHEEL_MAX_DELTA;
+		}
+		for (level = 1; delta >= (1UL << TIMER_WHEEL_SHIFT(level + 1)); level++) {
+			/* find the level */
+		}
+		slot = &s_wheel_ln[level - 1][(expires >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_LN_MASK];
+	}
+
+	timer_event_list_append(slot, event);
+	event->slot = slot;
+}
+
+/*
+ * Schedule given event to expire given number of ticks after
+ * given tick, splitting timeouts longer than the wheel can hold.
+ * Interrupts must be disabled.
+ */
+static void timer_wheel_arm(struct timer_event *event, u32_t base, u32_t num_ticks)
+{
+	event->remaining = 0;
+	if (num_ticks > TIMER_WHEEL_MAX_DELTA) {
+		event->remaining = num_ticks - TIMER_WHEEL_MAX_DELTA;
+		num_ticks = TIMER_WHEEL_MAX_DELTA;
+	}
+	event->expires = base + num_ticks;
+	timer_wheel_insert(event);
+}
+
+/*
+ * Reinsert the events in the current slot of given level (> 0)
+ * into the lower levels.
+ * Returns the index of the slot.
+ */
+static int timer_wheel_cascade(int level)
+{
+	int index = (s_wheel_tick >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_LN_MASK;
+	struct timer_event_list events;
+	struct timer_event *event;
+
+	timer_event_list_clear(&events);
+	timer_event_list_append_all(&events, &s_wheel_ln[level - 1][index]);
+	while ((event = timer_event_list_remove_first(&events)) != 0) {
+		timer_wheel_insert(event);
+	}
+	return index;
+}
+
+/*
+ * Process the timer wheel's current tick: run all of the
+ * events that expire on it.
+ */
+static void timer_wheel_run_tick(void)
+{
+	struct timer_event_list *slot;
+	struct timer_event *event;
+	int level;
+
+	KASSERT(!int_enabled());
+
+	/* when a level wraps around, pull down events from the next level */
+	if ((s_wheel_tick & TIMER_WHEEL_L0_MASK) == 0) {
+		for (level = 1; level < TIMER_WHEEL_LEVELS && timer_wheel_cascade(level) == 0; level++) {
+			/* cascade next level too */
+		}
+	}
+
+	slot = &s_wheel_l0[s_wheel_tick & TIMER_WHEEL_L0_MASK];
+	while ((event = timer_event_list_remove_first(slot)) != 0) {
+		event->slot = 0;
+		if (event->remaining > 0) {
+			/* a long timeout: wait for the rest of it */
+			timer_wheel_arm(event, s_wheel_tick, event->remaining);
+			continue;
+		}
+		event->func(event->arg);
+	}
+
+	++s_wheel_tick;
+}
+
+/*
+ * Process given number of elapsed timer ticks.
+ * Called from timer interrupt handler function: once per tick in
+ * periodic mode, or once per programmed interval in tickless mode.
+ * Only one CPU calls this function; it accounts the ticks for
+ * its own current thread.  See timer_process_cpu_ticks().
+ */
+void timer_process_ticks(u32_t num_ticks)
+{
+	u32_t prev_ticks = g_numticks;
+
+	/* update global tick counter */
+	g_numticks += num_ticks;
+
+	timer_process_cpu_ticks(num_ticks);
+
+	/* keep threads whose priority has decayed from starving */
+	if (g_numticks / TIMER_BOOST_INTERVAL != prev_ticks / TIMER_BOOST_INTERVAL) {
+		thread_boost_priorities();
+	}
+
+	/* run expired timer events */
+	while ((long) (g_numticks - s_wheel_tick) >= 0) {
+		timer_wheel_run_tick();
+	}
+}
+
 /*
- * Process a single timer tick.
- * Called from timer interrupt handler function.
+ * Charge given number of elapsed ticks to the current thread
+ * of the calling CPU, and end its quantum if it has run out.
+ * Called on every CPU for every tick.
  */
-void timer_process_tick(void)
+void timer_process_cpu_ticks(u32_t num_ticks)
 {
-	/* update global tick counter and current thread's tick counter */
-	++g_numticks;
-	g_current->num_ticks++;
+	/* update current thread's tick counter */
+	g_current->num_ticks += num_ticks;
+	g_current->total_ticks += num_ticks;
 
-	/* if current thread has used an entire quantum, force new thread to be scheduled */
-	if (g_current->num_ticks > TIMER_QUANTUM) {
+	if (thread_is_idle(g_current)) {
+		/*
+		 * The idle thread is preempted as soon as any other thread
+		 * becomes runnable, so it never needs a quantum.
+		 */
+		s_idle_ticks += num_ticks;
+	} else if (g_current->num_ticks > TIMER_QUANTUM) {
+		/* current thread has used an entire quantum, force new thread to be scheduled */
 		g_need_reschedule = 1;
 	}
 }
+
+/*
+ * Get the number of ticks until the next tick that
+ * timer_process_ticks() must see: either the end of the current
+ * thread's quantum (if another thread is waiting to run)
+ * or the expiration of a timer event.
+ * Only looks TIMER_TICKLESS_MAX_TICKS ahead; returns TIMER_NO_EVENT
+ * if there is no such tick in that window.
+ * Interrupts must be disabled.
+ */
+u32_t timer_next_event(void)
+{
+	u32_t next = TIMER_NO_EVENT;
+	u32_t tick;
+
+	KASSERT(!int_enabled());
+
+	if (thread_has_runnable()) {
+		if (thread_is_idle(g_current) || g_need_reschedule) {
+			/* a new thread is about to be switched in */
+			next = TIMER_QUANTUM + 1;
+		} else if (g_current->num_ticks > TIMER_QUANTUM) {
+			next = 1;
+		} else {
+			next = TIMER_QUANTUM + 1 - g_current->num_ticks;
+		}
+	}
+
+	/*
+	 * Find the first non-empty level 0 slot.  Events in higher levels
+	 * can't expire before level 0 wraps around (cascading them),
+	 * so stop there, including when that is the very next tick.
+	 */
+	for (tick = s_wheel_tick; tick - g_numticks < next && tick - g_numticks <= TIMER_TICKLESS_MAX_TICKS; tick++) {
+		if (!timer_event_list_is_empty(&s_wheel_l0[tick & TIMER_WHEEL_L0_MASK])
+		    || (tick & TIMER_WHEEL_L0_MASK) == 0) {
+			next = tick - g_numticks;
+			break;
+		}
+	}
+
+	return next == 0 ? 1 : next;
+}
+
+/*
+ * Get the number of ticks during which a CPU had nothing to do,
+ * summed over all CPUs.
+ * Comparing with g_numticks times the number of CPUs
+ * gives the CPU utilization.
+ */
+u32_t timer_get_idle_ticks(void)
+{
+	return s_idle_ticks;
+}
+
+/*
+ * Initialize a timer event that will call given function
+ * (from the timer interrupt handler) with given argument.
+ */
+void timer_event_init(struct timer_event *event, timer_func_t *func, void *arg)
+{
+	event->func = func;
+	event->arg = arg;
+	event->slot = 0;
+}
+
+/*
+ * Schedule given timer event to expire after given number of ticks.
+ * The event must not already be pending.
+ */
+void timer_event_add(struct timer_event *event, u32_t num_ticks)
+{
+	bool iflag = int_begin_atomic();
+	KASSERT(event->slot == 0);
+	timer_wheel_arm(event, g_numticks, num_ticks);
+	/* in tickless mode, the timer may be armed for a later tick */
+	timer_rearm();
+	int_end_atomic(iflag);
+}
+
+/*
+ * Cancel given timer event.
+ * Returns true if the event was pending, false if it had
+ * already expired (or was never added).
+ */
+bool timer_event_cancel(struct timer_event *event)
+{
+	bool iflag, pending;
+
+	iflag = int_begin_atomic();
+	pending = (event->slot != 0);
+	if (pending) {
+		timer_event_list_remove(event->slot, event);
+		event->slot = 0;
+	}
+	int_end_atomic(iflag);
+
+	return pending;
+}
+
+/*
+ * Suspend the current thread for (at least) given number of ticks.
+ */
+void timer_sleep(u32_t num_ticks)
+{
+	struct thread_queue nobody_wakes;
+	bool iflag;
+
+	/* wait on a queue nobody else knows about, so only the timeout ends the wait */
+	thread_queue_clear(&nobody_wakes);
+	iflag = int_begin_atomic();
+	thread_wait_timeout(&nobody_wakes, num_ticks);
+	int_end_atomic(iflag);
+}
@@ -22,21 +22,28 @@
 #include <geekos/errno.h>
 #include <geekos/string.h>
 #include <geekos/mem.h>
+#include <geekos/slab.h>
+#include <arch/atomic.h>
 
 /*
  * VFS locking and refcounting rules:
  *
- * - s_fs_mutex must be held while navigating the tree.
+ * - s_fs_lock must be held for reading while navigating the tree,
+ *   and for writing while changing parent or mount links (mounting).
+ *   Lookups only take the read side, so they run concurrently.
  *
- * - A directory inode is marked as busy while performing
- *   a lookup or other operation that depends upon or changes
- *   the tree structure.
+ * - Child lists only grow, and a new child is fully initialized
+ *   before it is appended, so a directory's child list can be
+ *   searched with just the read lock.  Adding a child requires the
+ *   directory's lookup_mutex, which is held across the (potentially
+ *   long-running) filesystem lookup so that a child is only
+ *   looked up once.  The read lock is released during that lookup,
+ *   so it doesn't block writers; the looking-up thread's reference
+ *   keeps the directory in the tree.  Removing a child will require
+ *   the write lock.
  *
- * - s_fs_mutex is unlocked when performing a potentially long-running
- *   I/O operation on a directory inode; re-acquired when finished.
- *   This is safe because the inode is marked as busy, so any
- *   concurrent vfs calls will be blocked if they reach the inode
- *   and try to do something.
+ * - Refcounts are changed atomically, since threads holding
+ *   the read lock may adjust them concurrently.
  *
  * - An inode's refcount is the number of threads holding an
  *   active reference to the inode, or any tree descendent of the inode.
@@ -44,8 +51,10 @@
  *   it has incremented the refcount of the inode and all of
  *   the inode's tree ancestors back to the root directory.
  *
- * - Acquisition order: s_fs_mutex is acquired before
- *   s_driver_list_mutex if both are to be held simultaneously.
+ * - Acquisition order: a directory's lookup_mutex is acquired before
+ *   s_fs_lock (a thread holding the read lock releases it before
+ *   waiting for a lookup_mutex), and s_fs_lock is acquired before
+ *   s_driver_list_mutex, when they are to be held simultaneously.
  */
 
 /* ---------- Private Implementation ---------- */
@@ -61,18 +70,20 @@ struct mutex s_driver_list_mutex;    /* protects changes/access to fs driver lis
 struct fs_driver *s_driver_list;     /* list of filesystem drivers */
 
 /* filesystem data structures */
-struct mutex s_fs_mutex;             /* protects changes/access to the tree structure */
+struct rwlock s_fs_lock;             /* protects changes/access to the tree structure */
 struct fs_instance *s_root_instance; /* root filesystem instance */
 struct inode *s_root_dir;            /* root directory */
 struct fs_instance_list s_inst_list; /* list of all mounted fs_instances */
 
+static struct slab_cache s_inode_cache = SLAB_CACHE_INITIALIZER("inode", sizeof(struct inode));
+
 /*
  * Adjust the refcount of given inode and all of its tree ancestors
  * by given delta.
  */
 static void vfs_adjust_refcounts(struct inode *inode, int delta)
 {
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	KASSERT(RWLOCK_IS_READ_HELD(&s_fs_lock) || RWLOCK_IS_WRITE_HELD(&s_fs_lock));
 
 	/*
 	 * FIXME: how should this operation work when it
@@ -81,9 +92,8 @@ static void vfs_adjust_refcounts(struct inode *inode, int delta)
 	 */
 
 	for (; inode != 0; inode = inode->parent) {
-		KASSERT(inode->refcount >= 0);
 		KASSERT(delta > 0 || inode->refcount > 0);
-		inode->refcount += delta;
+		atomic_fetch_add(&inode->refcount, (u32_t) delta);
 	}
 }
 
@@ -126,7 +136,7 @@ int vfs_do_mount(const char *fs_driver_name,
 	struct fs_instance *fs_inst = 0;
 	struct inode *root_dir = 0;
 
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	KASSERT(RWLOCK_IS_WRITE_HELD(&s_fs_lock));
 	KASSERT(mountpoint == 0 || (mountpoint->type == VFS_DIR && mountpoint->mount == 0));
 
 	/* if mounting root,
@@ -220,9 +230,28 @@ static int vfs_get_next_path_element(const char **p_path, char *namebuf)
 	return 0;
 }
 
+/*
+ * Search given directory's child list for named child.
+ * Returns the child, or null if it isn't in the list.
+ */
+static struct inode *vfs_find_child(struct inode *dir, const char *name)
+{
+	struct inode *child;
+
+	for (child = inode_list_get_first(&dir->child_list);
+	     child != 0;
+	     child = inode_list_next(child)) {
+		if (strncmp(name, child->name, VFS_NAMELEN_MAX) == 0) {
+			break;
+		}
+	}
+
+	return child;
+}
+
 /*
  * Search for named child in given directory.
- * The dir inode must be locked.
+ * The fs lock must be held for reading.
  * If sucessful, stores pointer to named child in p_inode and
  * returns 0.  Otherwise, returns error code.
  */
@@ -230,62 +259,51 @@ int vfs_lookup_child(struct inode *dir, const char *name, struct inode **p_inode
 {
 	int rc = 0;
 	struct inode *child;
+	bool added = false;
 
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	KASSERT(RWLOCK_IS_READ_HELD(&s_fs_lock));
 	KASSERT(dir->type == VFS_DIR);
-	KASSERT(dir->busy);
 
 	/* first, see if the child is already part of the dir's child list */
-	for (child = inode_list_get_first(&dir->child_list);
-	     child != 0;
-	     child = inode_list_next(child)) {
-		if (strncmp(name, dir->name, VFS_NAMELEN_MAX) == 0) {
-			*p_inode = child;
-			goto done;
-		}
+	child = vfs_find_child(dir, name);
+	if (child != 0) {
+		*p_inode = child;
+		return 0;
 	}
 
-	/* release fs mutex while search is in progress */
-	mutex_unlock(&s_fs_mutex);
+	/*
+	 * Release the fs lock while waiting for the directory and doing
+	 * the lookup I/O, so that a slow lookup doesn't hold up a writer
+	 * (and every reader queued behind it).  The caller's reference
+	 * keeps dir in the tree in the meantime.
+	 */
+	rwlock_read_unlock(&s_fs_lock);
+	mutex_lock(&dir->lookup_mutex);
+
+	/* another thread may have added the child while we waited
+	 * (children are only added with lookup_mutex held) */
+	child = vfs_find_child(dir, name);
+	if (child == 0) {
+		/* look up child from filesystem */
+		rc = dir->ops->lookup(dir, name, &child);
+		added = (rc == 0);
+	}
 
-	/* look up child from filesystem */
-	rc = dir->ops->lookup(dir, name, p_inode);
+	rwlock_read_lock(&s_fs_lock);
 
 	/* if lookup succeeded, add to dir's child list */
-	if (rc == 0) {
-		inode_list_append(&dir->child_list, *p_inode);
+	if (added) {
+		/* publish the child only once it is initialized */
+		atomic_barrier();
+		inode_list_append(&dir->child_list, child);
 	}
 
-	/* re-acquire the fs mutex */
-	mutex_lock(&s_fs_mutex);
-
-done:
-	return rc;
-}
+	mutex_unlock(&dir->lookup_mutex);
 
-/*
- * Lock a directory in preparation for a lookup.
- * fs mutex must be held.
- */
-static void vfs_lock_dir(struct inode *dir)
-{
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
-	while (dir->busy) {
-		cond_wait(&dir->inode_cond, &s_fs_mutex);
+	if (rc == 0) {
+		*p_inode = child;
 	}
-	dir->busy = true;
-}
-
-/*
- * Unlock a directory after completing a lookup.
- * fs mutex must be held.
- */
-static void vfs_unlock_dir(struct inode *dir)
-{
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
-	KASSERT(dir->busy);
-	dir->busy = false;
-	cond_broadcast(&dir->inode_cond);
+	return rc;
 }
 
 /* ---------- Public Interface ---------- */
@@ -294,9 +312,9 @@ int vfs_mount_root(const char *fs_driver_name, const char *init, const char *opt
 {
 	int rc;
 
-	mutex_lock(&s_fs_mutex);
+	rwlock_write_lock(&s_fs_lock);
 	rc = vfs_do_mount(fs_driver_name, 0, init, opts, &s_root_dir);
-	mutex_unlock(&s_fs_mutex);
+	rwlock_write_unlock(&s_fs_lock);
 
 	return rc;
 }
@@ -325,14 +343,16 @@ int vfs_mount(const char *path, const char *fs_driver_name, const char *init, co
 		goto done;
 	}
 
+	rwlock_write_lock(&s_fs_lock);
+
 	/* and it must not already have a filesystem mounted on it... */
 	if (mountpoint->mount != 0) {
+		rwlock_write_unlock(&s_fs_lock);
 		rc = EEXIST;
 		goto done;
 	}
 
 	/* now we can attempt to mount the filesystem. */
-	mutex_lock(&s_fs_mutex);
 	rc = vfs_do_mount(fs_driver_name, 0, init, opts, &mount_root_dir);
 	if (rc == 0) {
 		/* success */
@@ -348,7 +368,7 @@ int vfs_mount(const char *path, const char *fs_driver_name, const char *init, co
 		vfs_adjust_refcounts(mountpoint, 1);
 	}
 
-	mutex_unlock(&s_fs_mutex);
+	rwlock_write_unlock(&s_fs_lock);
 
 done:
 	vfs_release_ref(mountpoint);
@@ -365,7 +385,7 @@ int vfs_get_root_dir(struct inode **p_dir)
 {
 	int rc = 0;
 
-	mutex_lock(&s_fs_mutex);
+	rwlock_read_lock(&s_fs_lock);
 
 	/* return EEXIST if root filesystem hasn't been mounted yet */
 	if (!s_root_dir) {
@@ -375,10 +395,10 @@ int vfs_get_root_dir(struct inode **p_dir)
 
 	/* return ptr to root dir in p_dir and add a reference */
 	*p_dir = s_root_dir;
-	(*p_dir)->refcount++;
+	atomic_fetch_add(&(*p_dir)->refcount, 1);
 
 done:
-	mutex_lock(&s_fs_mutex);
+	rwlock_read_unlock(&s_fs_lock);
 
 	return rc;
 }
@@ -406,7 +426,7 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 	/* allocate a name buffer */
 	name = mem_alloc(VFS_NAMELEN_MAX + 1);
 
-	mutex_lock(&s_fs_mutex);
+	rwlock_read_lock(&s_fs_lock);
 
 	/* increment the refcount of start inode and each tree ancestor */
 	vfs_adjust_refcounts(start_dir, 1);
@@ -428,15 +448,8 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 			goto done;
 		}
 
-		/* lock dir */
-		vfs_lock_dir(inode);
-
 		/* look up child */
 		rc = vfs_lookup_child(inode, name, &child);
-
-		/* unlock dir */
-		vfs_unlock_dir(inode);
-
 		if (rc != 0) {
 			/* child not found */
 			goto done;
@@ -444,7 +457,7 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 
 		/* continue search in child */
 		inode = child;
-		inode->refcount++;
+		atomic_fetch_add(&inode->refcount, 1);
 	}
 
 	/* success: the path is empty and we have located the named inode */
@@ -460,7 +473,7 @@ done:
 		vfs_adjust_refcounts(inode, -1);
 	}
 
-	mutex_unlock(&s_fs_mutex);
+	rwlock_read_unlock(&s_fs_lock);
 
 	mem_free(name);
 
@@ -477,7 +490,7 @@ void vfs_release_ref(struct inode *inode)
 		return;
 	}
 
-	mutex_lock(&s_fs_mutex);
+	rwlock_read_lock(&s_fs_lock);
 
 	KASSERT(inode->refcount > 0);
 
@@ -490,7 +503,16 @@ void vfs_release_ref(struct inode *inode)
 	 * underlying filesystem file is deleted.
 	 */
 
-	mutex_unlock(&s_fs_mutex);
+	rwlock_read_unlock(&s_fs_lock);
+}
+
+/*
+ * Print contention statistics of the VFS locks.
+ */
+void vfs_dump_lock_stats(void)
+{
+	rwlock_dump_stats(&s_fs_lock, "vfs tree");
+	mutex_dump_stats(&s_driver_list_mutex, "vfs drivers");
 }
 
 int vfs_read(struct inode *inode, void *buf, size_t len)
@@ -565,7 +587,7 @@ int vfs_inode_create(
 {
 	struct inode *inode;
 
-	inode = mem_alloc(sizeof(struct inode));
+	inode = slab_alloc(&s_inode_cache);
 	inode->ops = ops;
 	inode->fs_inst = fs_inst;
 	inode->parent = parent;
@@ -573,7 +595,7 @@ int vfs_inode_create(
 	inode->name = name;
 	inode->p = p;
 	/* can omit initialization of other fields because
-	 * mem_alloc() has already zeroed the buffer */
+	 * slab_alloc() has already zeroed the buffer */
 
 	*p_inode = inode;
 	return 0;
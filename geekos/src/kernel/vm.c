@@ -18,6 +18,609 @@
  */
 
 #include <geekos/vm.h>
+#include <geekos/string.h>
+#include <geekos/timer.h>
+#include <geekos/slab.h>
+#include <geekos/int.h>
+#include <geekos/errno.h>
+
+/*
+ * NOTES:
+ * - Unlocked frames are reclaimed from vm_pagecaches by the
+ *   pageout thread when free frames run low.  Each pagecache's
+ *   pagelist is used as a CLOCK: frames are visited starting at the
+ *   head, and frames that have been referenced since the last visit
+ *   get a second chance by being moved to the tail.
+ * - Dirty pages are written back periodically by the flusher thread,
+ *   and on demand by vm_pagecache_sync().  Pages are written in
+ *   page number order, and runs of consecutive dirty pages are
+ *   coalesced into a single pager write.
+ * - s_pagecache_list_mutex is acquired before any vm_pagecache lock.
+ *   The pageout and flusher threads only ever trylock vm_pagecaches.
+ * - A thread never waits for a free frame while holding a vm_pagecache
+ *   lock, since the pageout thread may need the lock to free one.
+ *   Frames for new pages, and the radix tree nodes to index them,
+ *   are allocated with the lock released (or, for readahead,
+ *   only if a frame is free right away).  Readahead reads are
+ *   started with the lock released, since the pager may allocate.
+ */
+
+IMPLEMENT_LIST_APPEND(vm_pagecache_list, vm_pagecache)
+IMPLEMENT_LIST_REMOVE_FIRST(vm_pagecache_list, vm_pagecache)
+IMPLEMENT_LIST_REMOVE(vm_pagecache_list, vm_pagecache)
+IMPLEMENT_LIST_GET_FIRST(vm_pagecache_list, vm_pagecache)
+IMPLEMENT_LIST_NEXT(vm_pagecache_list, vm_pagecache)
+
+/* all vm_pagecaches, in the order the pageout thread will visit them */
+static struct vm_pagecache_list s_pagecache_list;
+static int s_num_pagecaches;
+static struct mutex s_pagecache_list_mutex;
+
+/* the flusher thread's references keep vm_pagecaches from being destroyed */
+static struct condition s_pagecache_unpinned_cond;
+
+/* pageout thread waits here when no frame could be reclaimed,
+ * until a frame is unlocked or VM_PAGEOUT_RETRY_TICKS pass
+ * (frames may also be freed by other users than vm_pagecaches) */
+static struct thread_queue s_pageout_retry_waitqueue;
+#define VM_PAGEOUT_RETRY_TICKS TIMER_MS_TO_TICKS(100)
+
+/* interval at which the flusher thread writes back dirty pages */
+#define VM_FLUSH_INTERVAL_TICKS TIMER_MS_TO_TICKS(5000)
+
+/*
+ * Readahead: when pages of a vm_pagecache are locked sequentially,
+ * the following pages are read asynchronously.  The window starts
+ * at VM_READAHEAD_MIN pages and doubles (up to VM_READAHEAD_MAX)
+ * each time the reader gets within half a window of its end.
+ * Readahead is skipped when free frames are scarce.
+ */
+#define VM_READAHEAD_MIN 4
+#define VM_READAHEAD_MAX 32
+#define VM_READAHEAD_MIN_FREE_FRAMES 256
+
+/*
+ * An asynchronous read of a run of consecutive pages.
+ */
+struct vm_pagein_io {
+	struct vm_pagecache *obj;
+	struct frame *frames[VM_PAGER_MAX_PAGES];
+	unsigned num_frames;
+	int rc;
+	struct vm_pagein_io *next; /* link in list of completed reads */
+};
+
+/* asynchronous reads that have completed, and the queue
+ * in which the pagein completion thread waits for them */
+static struct vm_pagein_io *s_pagein_done_head, *s_pagein_done_tail;
+static struct thread_queue s_pagein_done_waitqueue;
+
+static struct slab_cache s_pagein_io_cache = SLAB_CACHE_INITIALIZER("vm_pagein_io", sizeof(struct vm_pagein_io));
+
+/*
+ * Take a zero-filled radix tree node from a vm_pagecache's spares.
+ * Enough spares must have been set aside by vm_radix_reserve().
+ */
+static void **vm_radix_alloc_node(struct vm_pagecache *obj)
+{
+	void **node = obj->radix_spare;
+
+	KASSERT(obj->radix_num_spare > 0);
+	obj->radix_spare = node[0];
+	obj->radix_num_spare--;
+	node[0] = 0;
+
+	return node;
+}
+
+/*
+ * Add a zero-filled radix tree node to a vm_pagecache's spares.
+ */
+static void vm_radix_add_spare(struct vm_pagecache *obj, void **node)
+{
+	node[0] = obj->radix_spare;
+	obj->radix_spare = node;
+	obj->radix_num_spare++;
+}
+
+/*
+ * Free a radix tree node and (recursively) all of its descendents.
+ * The frames stored in the leaves are not affected.
+ */
+static void vm_radix_free_node(void **node, unsigned height)
+{
+	struct frame *frame;
+	int i;
+
+	if (height > 1) {
+		for (i = 0; i < VM_RADIX_SLOTS; i++) {
+			if (node[i] != 0) {
+				vm_radix_free_node(node[i], height - 1);
+			}
+		}
+	}
+
+	frame = mem_pa_to_frame(node);
+	frame->refcount = 0;
+	mem_free_frame(frame);
+}
+
+/*
+ * Get the largest page number that can be indexed
+ * by a radix tree of given height.
+ */
+static u32_t vm_radix_max_page_num(unsigned height)
+{
+	if (height * VM_RADIX_SHIFT >= 32) {
+		return ~0UL;
+	}
+	return (1UL << (height * VM_RADIX_SHIFT)) - 1;
+}
+
+/*
+ * Find the frame containing given page in a vm_pagecache's
+ * radix tree.  Returns null if the page is not present.
+ */
+static struct frame *vm_radix_lookup(struct vm_pagecache *obj, u32_t page_num)
+{
+	void **node = obj->radix_root;
+	unsigned height = obj->radix_height;
+
+	if (height == 0 || page_num > vm_radix_max_page_num(height)) {
+		return 0;
+	}
+
+	while (height > 1) {
+		node = node[(page_num >> ((height - 1) * VM_RADIX_SHIFT)) & VM_RADIX_MASK];
+		if (node == 0) {
+			return 0;
+		}
+		height--;
+	}
+
+	return node[page_num & VM_RADIX_MASK];
+}
+
+/*
+ * Find up to max_frames frames in the subtree rooted at given node,
+ * in order of page number, skipping pages before start.
+ * Returns the number of frames found.
+ */
+static unsigned vm_radix_gang_lookup_node(void **node, unsigned height, u32_t start,
+	struct frame **frames, unsigned max_frames)
+{
+	unsigned slot = (start >> ((height - 1) * VM_RADIX_SHIFT)) & VM_RADIX_MASK;
+	unsigned num_found = 0;
+
+	/* only the first slot visited can contain pages before start */
+	for (; slot < VM_RADIX_SLOTS && num_found < max_frames; slot++, start = 0) {
+		if (node[slot] == 0) {
+			continue;
+		}
+		if (height == 1) {
+			frames[num_found++] = node[slot];
+		} else {
+			num_found += vm_radix_gang_lookup_node(node[slot], height - 1, start,
+				frames + num_found, max_frames - num_found);
+		}
+	}
+
+	return num_found;
+}
+
+/*
+ * Find up to max_frames frames in a vm_pagecache's radix tree,
+ * in order of page number, starting at given page number.
+ * Returns the number of frames found.
+ */
+static unsigned vm_radix_gang_lookup(struct vm_pagecache *obj, u32_t start,
+	struct frame **frames, unsigned max_frames)
+{
+	if (obj->radix_height == 0 || start > vm_radix_max_page_num(obj->radix_height)) {
+		return 0;
+	}
+	return vm_radix_gang_lookup_node(obj->radix_root, obj->radix_height, start, frames, max_frames);
+}
+
+/*
+ * Store given frame (or null, to remove a page) in the
+ * slot for given page number in a vm_pagecache's radix tree.
+ */
+static void vm_radix_store(struct vm_pagecache *obj, u32_t page_num, struct frame *frame)
+{
+	void **node, **child;
+	unsigned height;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	/* grow the tree until it is tall enough to index page_num */
+	while (obj->radix_height == 0 || page_num > vm_radix_max_page_num(obj->radix_height)) {
+		if (frame == 0) {
+			return; /* nothing to remove */
+		}
+		node = vm_radix_alloc_node(obj);
+		node[0] = obj->radix_root; /* old root covers the lowest page numbers */
+		obj->radix_root = node;
+		obj->radix_height++;
+	}
+
+	/* descend to the leaf, creating interior nodes as needed */
+	node = obj->radix_root;
+	for (height = obj->radix_height; height > 1; height--) {
+		unsigned slot = (page_num >> ((height - 1) * VM_RADIX_SHIFT)) & VM_RADIX_MASK;
+		child = node[slot];
+		if (child == 0) {
+			if (frame == 0) {
+				return; /* nothing to remove */
+			}
+			child = vm_radix_alloc_node(obj);
+			node[slot] = child;
+		}
+		node = child;
+	}
+
+	node[page_num & VM_RADIX_MASK] = frame;
+}
+
+/*
+ * Get the (maximum) number of radix tree nodes that must be
+ * allocated to store a frame for given page number.
+ */
+static unsigned vm_radix_num_nodes_needed(struct vm_pagecache *obj, u32_t page_num)
+{
+	void **node = obj->radix_root;
+	unsigned height = obj->radix_height;
+	unsigned num_new_roots = 0;
+
+	if (height == 0 || page_num > vm_radix_max_page_num(height)) {
+		/* new root nodes, and the interior nodes and leaf below them */
+		while (height == 0 || page_num > vm_radix_max_page_num(height)) {
+			height++;
+			num_new_roots++;
+		}
+		return num_new_roots + height - 1;
+	}
+
+	while (height > 1) {
+		node = node[(page_num >> ((height - 1) * VM_RADIX_SHIFT)) & VM_RADIX_MASK];
+		if (node == 0) {
+			return height - 1;
+		}
+		height--;
+	}
+
+	return 0;
+}
+
+/*
+ * Make sure a vm_pagecache has enough spare radix tree nodes
+ * to add a frame for given page.  If wait is true, the vm_pagecache
+ * lock is released while waiting for memory; otherwise, gives up
+ * and returns false if no frame is free.
+ */
+static bool vm_radix_reserve(struct vm_pagecache *obj, u32_t page_num, bool wait)
+{
+	struct frame *frame;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	while (vm_radix_num_nodes_needed(obj, page_num) > obj->radix_num_spare) {
+		if (wait) {
+			mutex_unlock(&obj->lock);
+			frame = mem_alloc_zeroed_frame(FRAME_KERN, 1);
+			mutex_lock(&obj->lock);
+		} else {
+			frame = mem_try_alloc_frame(FRAME_KERN, 1);
+			if (frame == 0) {
+				return false;
+			}
+			memset(mem_frame_to_pa(frame), '\0', PAGE_SIZE);
+		}
+		vm_radix_add_spare(obj, mem_frame_to_pa(frame));
+	}
+
+	return true;
+}
+
+/*
+ * Add a frame to a vm_pagecache, making it visible to lookups.
+ */
+static void vm_add_frame(struct vm_pagecache *obj, u32_t page_num, struct frame *frame)
+{
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+	KASSERT(vm_radix_lookup(obj, page_num) == 0);
+
+	frame->vm_pgcache = obj;
+	frame->vm_pgcache_page_num = page_num;
+	frame->referenced = false;
+	frame_list_append(&obj->pagelist, frame);
+	vm_radix_store(obj, page_num, frame);
+	obj->num_pages++;
+}
+
+/*
+ * Remove a frame from a vm_pagecache.
+ */
+static void vm_remove_frame(struct vm_pagecache *obj, struct frame *frame)
+{
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+	KASSERT(vm_radix_lookup(obj, frame->vm_pgcache_page_num) == frame);
+
+	frame_list_remove(&obj->pagelist, frame);
+	vm_radix_store(obj, frame->vm_pgcache_page_num, 0);
+	obj->num_pages--;
+	frame->vm_pgcache = 0;
+}
+
+/*
+ * A frame's refcount has dropped to 0, so it might now be reclaimable:
+ * if the pageout thread is stalled, let it try again.
+ */
+static void vm_frame_unlocked(void)
+{
+	bool iflag;
+
+	if (!thread_queue_is_empty(&s_pageout_retry_waitqueue)) {
+		iflag = int_begin_atomic();
+		thread_wakeup(&s_pageout_retry_waitqueue);
+		int_end_atomic(iflag);
+	}
+}
+
+/*
+ * Write back a run of dirty frames containing consecutive pages.
+ * The vm_pagecache lock is released while the I/O is in progress;
+ * the frames are locked in the meantime so that they can't be evicted.
+ */
+static int vm_writeback_frames(struct vm_pagecache *obj, struct frame **frames, unsigned num_frames)
+{
+	int rc;
+	unsigned i;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+	KASSERT(num_frames > 0 && num_frames <= VM_PAGER_MAX_PAGES);
+
+	/* if a page is modified while the write is in progress,
+	 * it will be marked dirty again */
+	for (i = 0; i < num_frames; i++) {
+		KASSERT(frames[i]->content == PAGE_DIRTY);
+		KASSERT(frames[i]->vm_pgcache_page_num == frames[0]->vm_pgcache_page_num + i);
+		frames[i]->refcount++;
+		frames[i]->content = PAGE_CLEAN;
+		obj->num_dirty--;
+	}
+
+	mutex_unlock(&obj->lock);
+	rc = vm_pageout_pages(obj->pager, frames[0]->vm_pgcache_page_num, frames, num_frames);
+	mutex_lock(&obj->lock);
+
+	for (i = 0; i < num_frames; i++) {
+		if (rc != 0 && frames[i]->content == PAGE_CLEAN) {
+			frames[i]->content = PAGE_DIRTY;
+			obj->num_dirty++;
+		}
+		frames[i]->refcount--;
+		if (frames[i]->refcount == 0) {
+			vm_frame_unlocked();
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Write back a single dirty frame.
+ */
+static int vm_writeback_frame(struct vm_pagecache *obj, struct frame *frame)
+{
+	return vm_writeback_frames(obj, &frame, 1);
+}
+
+/*
+ * Write back all dirty pages of a vm_pagecache, in page number order,
+ * coalescing runs of consecutive dirty pages into single writes.
+ * Returns 0 if successful, or the error code of the first failed write
+ * (the pages that couldn't be written remain dirty).
+ */
+static int vm_flush_pagecache(struct vm_pagecache *obj)
+{
+	struct frame *batch[VM_PAGER_MAX_PAGES];
+	u32_t page_num = 0, next_page_num;
+	unsigned num_found, i, j;
+	int rc, first_rc = 0;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	while (obj->num_dirty > 0) {
+		num_found = vm_radix_gang_lookup(obj, page_num, batch, VM_PAGER_MAX_PAGES);
+		if (num_found == 0) {
+			break;
+		}
+
+		/* find the first dirty page in the batch */
+		for (i = 0; i < num_found && batch[i]->content != PAGE_DIRTY; i++) {
+		}
+
+		if (i == num_found) {
+			next_page_num = batch[num_found - 1]->vm_pgcache_page_num + 1;
+		} else if (i > 0) {
+			/* look up again starting at the dirty page, so the
+			 * run can be as long as possible */
+			next_page_num = batch[i]->vm_pgcache_page_num;
+		} else {
+			/* write the run of consecutive dirty pages at the start of the batch */
+			for (j = 1; j < num_found &&
+			     batch[j]->content == PAGE_DIRTY &&
+			     batch[j]->vm_pgcache_page_num == batch[j - 1]->vm_pgcache_page_num + 1; j++) {
+			}
+			next_page_num = batch[j - 1]->vm_pgcache_page_num + 1;
+
+			rc = vm_writeback_frames(obj, batch, j);
+			if (rc != 0 && first_rc == 0) {
+				first_rc = rc;
+			}
+		}
+
+		if (next_page_num == 0) {
+			break; /* reached the largest page number */
+		}
+		page_num = next_page_num;
+	}
+
+	return first_rc;
+}
+
+/*
+ * Reclaim up to given number of unlocked frames from a vm_pagecache.
+ * Returns the number of frames freed.
+ */
+static ulong_t vm_reclaim_from_pagecache(struct vm_pagecache *obj, ulong_t target)
+{
+	struct frame *frame, *next;
+	ulong_t num_freed = 0;
+	u32_t num_to_visit;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	/* visit each frame at most twice: referenced frames get a second chance */
+	num_to_visit = obj->num_pages * 2;
+
+	for (frame = frame_list_get_first(&obj->pagelist);
+	     frame != 0 && num_freed < target && num_to_visit > 0;
+	     frame = next, num_to_visit--) {
+		next = frame_list_next(frame);
+
+		/* locked frames, and frames still being read, can't be evicted */
+		if (frame->refcount > 0 || frame->content == PAGE_PENDING_INIT) {
+			continue;
+		}
+
+		/* recently used frames go to the back of the line */
+		if (frame->referenced) {
+			frame->referenced = false;
+			frame_list_remove(&obj->pagelist, frame);
+			frame_list_append(&obj->pagelist, frame);
+			if (next == 0) {
+				next = frame;
+			}
+			continue;
+		}
+
+		/* modified frames must be written back before they can be evicted */
+		if (frame->content == PAGE_DIRTY) {
+			if (vm_writeback_frame(obj, frame) != 0) {
+				continue;
+			}
+			/* pagecache was unlocked: the frame may have been locked,
+			 * redirtied or moved, so start over from the head */
+			next = frame_list_get_first(&obj->pagelist);
+			if (frame->refcount > 0 || frame->content != PAGE_CLEAN) {
+				continue;
+			}
+		}
+
+		/* evict! */
+		vm_remove_frame(obj, frame);
+		mem_free_frame(frame);
+		num_freed++;
+	}
+
+	return num_freed;
+}
+
+/*
+ * Reclaim up to given number of frames from all vm_pagecaches.
+ * Returns the number of frames freed.
+ */
+static ulong_t vm_reclaim_frames(ulong_t target)
+{
+	struct vm_pagecache *obj;
+	ulong_t num_freed = 0;
+	int num_to_visit;
+
+	mutex_lock(&s_pagecache_list_mutex);
+
+	/* visit each pagecache at most once */
+	num_to_visit = s_num_pagecaches;
+	while (num_freed < target && num_to_visit-- > 0) {
+		/* rotate the pagecache list, so that pressure is spread evenly */
+		obj = vm_pagecache_list_remove_first(&s_pagecache_list);
+		vm_pagecache_list_append(&s_pagecache_list, obj);
+
+		if (!mutex_trylock(&obj->lock)) {
+			continue;
+		}
+		num_freed += vm_reclaim_from_pagecache(obj, target - num_freed);
+		mutex_unlock(&obj->lock);
+	}
+
+	mutex_unlock(&s_pagecache_list_mutex);
+
+	return num_freed;
+}
+
+/*
+ * Flusher thread: periodically write back dirty pages.
+ */
+static void vm_flusher_thread(ulong_t arg)
+{
+	struct vm_pagecache *obj, *next;
+
+	while (true) {
+		timer_sleep(VM_FLUSH_INTERVAL_TICKS);
+
+		mutex_lock(&s_pagecache_list_mutex);
+		obj = vm_pagecache_list_get_first(&s_pagecache_list);
+		while (obj != 0) {
+			/* unlocked peek at num_dirty: a miss is caught next time */
+			if (obj->num_dirty == 0) {
+				obj = vm_pagecache_list_next(obj);
+				continue;
+			}
+
+			/* pin the vm_pagecache, so the list mutex needn't be
+			 * held (stalling other pagecache users) during the writes */
+			obj->num_pins++;
+			mutex_unlock(&s_pagecache_list_mutex);
+
+			if (mutex_trylock(&obj->lock)) {
+				/* pages that couldn't be written remain dirty, and are retried next time */
+				vm_flush_pagecache(obj);
+				mutex_unlock(&obj->lock);
+			}
+
+			/* if the pageout thread rotated the list meanwhile,
+			 * some vm_pagecaches may be skipped until next time */
+			mutex_lock(&s_pagecache_list_mutex);
+			next = vm_pagecache_list_next(obj);
+			if (--obj->num_pins == 0) {
+				cond_broadcast(&s_pagecache_unpinned_cond);
+			}
+			obj = next;
+		}
+		mutex_unlock(&s_pagecache_list_mutex);
+	}
+}
+
+/*
+ * Pageout thread: evict pages from vm_pagecaches
+ * when free frames are running low.
+ */
+static void vm_pageout_thread(ulong_t arg)
+{
+	ulong_t target;
+
+	while (true) {
+		target = mem_wait_for_reclaim();
+
+		if (vm_reclaim_frames(target) == 0) {
+			/* nothing could be evicted: wait for a frame to be unlocked */
+			int_disable();
+			thread_wait_timeout(&s_pageout_retry_waitqueue, VM_PAGEOUT_RETRY_TICKS);
+			int_enable();
+		}
+	}
+}
 
 static void vm_release_frame_ref(struct vm_pagecache *obj, struct frame *frame)
 {
@@ -33,24 +636,238 @@ static void vm_release_frame_ref(struct vm_pagecache *obj, struct frame *frame)
 	 * then eagerly remove it from the vm_pagecache.
 	 */
 	if (frame->refcount == 0 && frame->content == PAGE_FAILED_INIT) {
-		frame_list_remove(&obj->pagelist, frame);
+		vm_remove_frame(obj, frame);
 		mem_free_frame(frame);
+	} else if (frame->refcount == 0) {
+		vm_frame_unlocked();
 	}
 }
 
-static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
+/*
+ * Asynchronous pagein completion callback.
+ * May be called from interrupt context, so just queue the
+ * read for the pagein completion thread.
+ */
+static void vm_pagein_async_done(void *data, int rc)
 {
-	int rc;
+	struct vm_pagein_io *io = data;
+	bool iflag;
+
+	io->rc = rc;
+	io->next = 0;
+
+	iflag = int_begin_atomic();
+	if (s_pagein_done_head == 0) {
+		s_pagein_done_head = s_pagein_done_tail = io;
+	} else {
+		s_pagein_done_tail->next = io;
+		s_pagein_done_tail = io;
+	}
+	thread_wakeup_one(&s_pagein_done_waitqueue);
+	int_end_atomic(iflag);
+}
+
+/*
+ * Pagein completion thread: publish the contents of frames read
+ * asynchronously, waking up threads waiting for them.
+ * This is a dedicated thread (rather than the workqueue) because it
+ * must lock vm_pagecaches, and the workqueue may be needed to complete
+ * the I/O of a thread holding a vm_pagecache lock.
+ */
+static void vm_pagein_done_thread(ulong_t arg)
+{
+	struct vm_pagein_io *io;
+	struct vm_pagecache *obj;
+	unsigned i;
+
+	while (true) {
+		int_disable();
+		while (s_pagein_done_head == 0) {
+			thread_wait(&s_pagein_done_waitqueue);
+		}
+		io = s_pagein_done_head;
+		s_pagein_done_head = io->next;
+		if (s_pagein_done_head == 0) {
+			s_pagein_done_tail = 0;
+		}
+		int_enable();
+
+		obj = io->obj;
+
+		mutex_lock(&obj->lock);
+		for (i = 0; i < io->num_frames; i++) {
+			struct frame *frame = io->frames[i];
+			KASSERT(frame->content == PAGE_PENDING_INIT);
+			frame->content = (io->rc == 0) ? PAGE_CLEAN : PAGE_FAILED_INIT;
+			frame->errc = io->rc;
+
+			/* release the reference held on behalf of the I/O */
+			vm_release_frame_ref(obj, frame);
+		}
+		obj->num_readahead -= io->num_frames;
+		cond_broadcast(&obj->cond);
+		mutex_unlock(&obj->lock);
+
+		slab_free(&s_pagein_io_cache, io);
+	}
+}
+
+/*
+ * Start the asynchronous read of a run of consecutive pages
+ * collected for readahead.  The vm_pagecache must not be locked,
+ * since the pager may wait for memory to start the read.
+ */
+static void vm_readahead_submit(struct vm_pagecache *obj, struct frame **frames, unsigned num_frames)
+{
+	struct vm_pagein_io *io;
+	unsigned i;
+
+	KASSERT(!MUTEX_IS_HELD(&obj->lock));
+	KASSERT(num_frames > 0 && num_frames <= VM_PAGER_MAX_PAGES);
+
+	io = slab_alloc(&s_pagein_io_cache);
+	io->obj = obj;
+	io->num_frames = num_frames;
+	memcpy(io->frames, frames, num_frames * sizeof(struct frame *));
+
+	if (vm_pagein_pages_async(obj->pager, frames[0]->vm_pgcache_page_num,
+		io->frames, num_frames, &vm_pagein_async_done, io) != 0) {
+		/* couldn't start the read: discard the frames */
+		mutex_lock(&obj->lock);
+		for (i = 0; i < num_frames; i++) {
+			io->frames[i]->content = PAGE_FAILED_INIT;
+			vm_release_frame_ref(obj, io->frames[i]);
+		}
+		obj->num_readahead -= num_frames;
+		cond_broadcast(&obj->cond);
+		mutex_unlock(&obj->lock);
+
+		slab_free(&s_pagein_io_cache, io);
+	}
+}
+
+/*
+ * Start asynchronous reads of the pages in given range that
+ * aren't already present.  Each run of consecutive missing
+ * pages is read by a single pager operation.
+ * Stops early if frames are scarce.
+ * The frames are added with the vm_pagecache locked (without
+ * waiting for memory), then the lock is released while the reads
+ * are started; the frames stay locked until the reads complete.
+ */
+static void vm_readahead_range(struct vm_pagecache *obj, u32_t start, u32_t end)
+{
+	struct frame *frames[VM_READAHEAD_MAX];
+	unsigned num_frames = 0, run_start, i;
+	u32_t page_num;
 	struct frame *frame;
 
 	KASSERT(MUTEX_IS_HELD(&obj->lock));
+	KASSERT(end - start <= VM_READAHEAD_MAX);
 
-	/* allocate a fresh frame */
-	frame = mem_alloc_frame(FRAME_VM_PGCACHE, 1);
+	for (page_num = start; page_num != end; page_num++) {
+		if (vm_radix_lookup(obj, page_num) != 0) {
+			continue;
+		}
+		if (mem_get_num_free_frames() < VM_READAHEAD_MIN_FREE_FRAMES
+		    || !vm_radix_reserve(obj, page_num, false)) {
+			break;
+		}
+		frame = mem_try_alloc_frame(FRAME_VM_PGCACHE, 1);
+		if (frame == 0) {
+			break;
+		}
+		frame->content = PAGE_PENDING_INIT;
+		vm_add_frame(obj, page_num, frame);
+		frames[num_frames++] = frame;
+	}
 
-	/* append frame to pagelist, mark as having pending I/O */
-	frame_list_append(&obj->pagelist, frame);
+	if (num_frames == 0) {
+		return;
+	}
+
+	/* vm_pagecache_destroy() waits for these to complete */
+	obj->num_readahead += num_frames;
+
+	mutex_unlock(&obj->lock);
+	for (run_start = 0, i = 1; i <= num_frames; i++) {
+		if (i == num_frames || i - run_start == VM_PAGER_MAX_PAGES
+		    || frames[i]->vm_pgcache_page_num != frames[i - 1]->vm_pgcache_page_num + 1) {
+			vm_readahead_submit(obj, &frames[run_start], i - run_start);
+			run_start = i;
+		}
+	}
+	mutex_lock(&obj->lock);
+}
+
+/*
+ * Detect sequential access to a vm_pagecache, and read ahead
+ * of the reader if appropriate.  Called for every vm_lock_page().
+ * The vm_pagecache lock may be released and reacquired.
+ */
+static void vm_readahead(struct vm_pagecache *obj, u32_t page_num)
+{
+	u32_t start, end;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	if (page_num != obj->ra_prev_page + 1 || obj->pager->ops->read_pages_async == 0) {
+		/* not sequential: reset the readahead window */
+		obj->ra_prev_page = page_num;
+		obj->ra_next_page = page_num + 1;
+		obj->ra_window = 0;
+		return;
+	}
+	obj->ra_prev_page = page_num;
+
+	/* only start more readahead once the reader is within
+	 * half a window of the end of the current one */
+	if (obj->ra_window > 0 && obj->ra_next_page - page_num > obj->ra_window / 2) {
+		return;
+	}
+
+	obj->ra_window = (obj->ra_window == 0) ? VM_READAHEAD_MIN : obj->ra_window * 2;
+	if (obj->ra_window > VM_READAHEAD_MAX) {
+		obj->ra_window = VM_READAHEAD_MAX;
+	}
+
+	start = (obj->ra_next_page > page_num) ? obj->ra_next_page : page_num + 1;
+	end = page_num + 1 + obj->ra_window;
+	if (end < start) {
+		return; /* page numbers wrapped around */
+	}
+
+	/* don't read past the end of the backing store */
+	if (end > vm_pager_get_num_pages(obj->pager)) {
+		end = vm_pager_get_num_pages(obj->pager);
+		if (end <= start) {
+			return;
+		}
+	}
+
+	obj->ra_next_page = end;
+	vm_readahead_range(obj, start, end);
+}
+
+/*
+ * Add given fresh frame to a vm_pagecache for given page,
+ * and page in its contents.  The radix tree nodes needed
+ * to index it must have been reserved.
+ */
+static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num,
+	struct frame *frame, struct frame **p_frame)
+{
+	int rc;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+	KASSERT(frame->refcount == 0);
+
+	/* lock the frame on behalf of the caller */
+	frame->refcount = 1;
+
+	/* add frame to pagelist and index, mark as having pending I/O */
 	frame->content = PAGE_PENDING_INIT;
+	vm_add_frame(obj, page_num, frame);
 
 	/* unlock the vm_pagecache mutex while pagein is being done.
 	 * because we set the content to PAGE_PENDING_INIT,
@@ -66,6 +883,7 @@ static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num, struct
 
 	/* update frame content based on success/failure of pagein */
 	frame->content = (rc == 0) ? PAGE_CLEAN : PAGE_FAILED_INIT;
+	frame->errc = rc;
 
 	/* other threads may be waiting to learn content state */
 	cond_broadcast(&obj->cond);
@@ -101,6 +919,18 @@ int vm_pager_create(struct vm_pager_ops *ops, void *p, struct vm_pager **p_pager
 	return 0;
 }
 
+/*
+ * Get the number of pages in given pager's backing store.
+ * Returns 0xFFFFFFFF if the pager doesn't know its size.
+ */
+u32_t vm_pager_get_num_pages(struct vm_pager *pager)
+{
+	if (pager->ops->get_num_pages == 0) {
+		return 0xFFFFFFFFU;
+	}
+	return pager->ops->get_num_pages(pager);
+}
+
 /*
  * Page in (read) data into given frame.
  */
@@ -109,6 +939,64 @@ int vm_pagein(struct vm_pager *pager, u32_t page_num, struct frame *frame)
 	return pager->ops->read_page(pager, mem_frame_to_pa(frame), page_num);
 }
 
+/*
+ * Get the buffers of given frames, for a vectored pager operation.
+ */
+static void vm_frames_to_bufs(struct frame **frames, unsigned num_frames, void **bufs)
+{
+	unsigned i;
+
+	KASSERT(num_frames > 0 && num_frames <= VM_PAGER_MAX_PAGES);
+
+	for (i = 0; i < num_frames; i++) {
+		bufs[i] = mem_frame_to_pa(frames[i]);
+	}
+}
+
+/*
+ * Page in (read) data into given frames, which will hold
+ * consecutive pages starting at page_num.  Uses a single pager
+ * read if the pager supports it.
+ */
+int vm_pagein_pages(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames)
+{
+	void *bufs[VM_PAGER_MAX_PAGES];
+	unsigned i;
+	int rc;
+
+	if (pager->ops->read_pages == 0 || num_frames == 1) {
+		for (i = 0; i < num_frames; i++) {
+			rc = vm_pagein(pager, page_num + i, frames[i]);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+		return 0;
+	}
+
+	vm_frames_to_bufs(frames, num_frames, bufs);
+	return pager->ops->read_pages(pager, bufs, page_num, num_frames);
+}
+
+/*
+ * Start paging in data into given frames, which will hold
+ * consecutive pages starting at page_num, without waiting for
+ * the read to complete.  The callback is invoked when it does.
+ * Returns ENOTSUP if the pager doesn't support asynchronous reads.
+ */
+int vm_pagein_pages_async(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames,
+	vm_pager_callback_t *callback, void *data)
+{
+	void *bufs[VM_PAGER_MAX_PAGES];
+
+	if (pager->ops->read_pages_async == 0) {
+		return ENOTSUP;
+	}
+
+	vm_frames_to_bufs(frames, num_frames, bufs);
+	return pager->ops->read_pages_async(pager, bufs, page_num, num_frames, callback, data);
+}
+
 /*
  * Page out (write) data contained in given frame.
  */
@@ -117,6 +1005,49 @@ int vm_pageout(struct vm_pager *pager, u32_t page_num, struct frame *frame)
 	return pager->ops->write_page(pager, mem_frame_to_pa(frame), page_num);
 }
 
+/*
+ * Page out (write) data contained in given frames, which hold
+ * consecutive pages starting at page_num.  Uses a single pager
+ * write if the pager supports it.
+ */
+int vm_pageout_pages(struct vm_pager *pager, u32_t page_num, struct frame **frames, unsigned num_frames)
+{
+	void *bufs[VM_PAGER_MAX_PAGES];
+	unsigned i;
+	int rc;
+
+	if (pager->ops->write_pages == 0 || num_frames == 1) {
+		for (i = 0; i < num_frames; i++) {
+			rc = vm_pageout(pager, page_num + i, frames[i]);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+		return 0;
+	}
+
+	vm_frames_to_bufs(frames, num_frames, bufs);
+	return pager->ops->write_pages(pager, bufs, page_num, num_frames);
+}
+
+/*
+ * Start the pageout, flusher, and pagein completion threads.
+ */
+void vm_pagecache_init(void)
+{
+	thread_create(&vm_pageout_thread, 0UL, THREAD_DETACHED);
+	thread_create_priority(&vm_flusher_thread, 0UL, THREAD_DETACHED, THREAD_PRIORITY_LOW);
+	thread_create_priority(&vm_pagein_done_thread, 0UL, THREAD_DETACHED, THREAD_PRIORITY_HIGH);
+}
+
+/*
+ * Print contention statistics of the vm_pagecache list lock.
+ */
+void vm_dump_lock_stats(void)
+{
+	mutex_dump_stats(&s_pagecache_list_mutex, "pagecache list");
+}
+
 /*
  * Create a vm_pagecache using the given pager
  * as its underlying data store.
@@ -125,17 +1056,80 @@ int vm_pagecache_create(struct vm_pager *pager, struct vm_pagecache **p_obj)
 {
 	struct vm_pagecache *obj;
 
+	/* a radix tree node must fill exactly one page */
+	KASSERT(VM_RADIX_SLOTS * sizeof(void *) == PAGE_SIZE);
+
 	obj = mem_alloc(sizeof(struct vm_pagecache));
 
 	mutex_init(&obj->lock);
 	cond_init(&obj->cond);
 	frame_list_clear(&obj->pagelist);
+	obj->radix_root = 0;
+	obj->radix_height = 0;
+	obj->radix_spare = 0;
+	obj->radix_num_spare = 0;
+	obj->num_pins = 0;
+	obj->num_readahead = 0;
+	obj->num_pages = 0;
+	obj->num_dirty = 0;
+	obj->ra_prev_page = ~0UL;
+	obj->ra_next_page = 0;
+	obj->ra_window = 0;
 	obj->pager = pager;
 
+	mutex_lock(&s_pagecache_list_mutex);
+	vm_pagecache_list_append(&s_pagecache_list, obj);
+	s_num_pagecaches++;
+	mutex_unlock(&s_pagecache_list_mutex);
+
 	*p_obj = obj;
 	return 0;
 }
 
+/*
+ * Destroy a vm_pagecache, freeing all of its frames.
+ * No pages may be locked.  Page contents are discarded
+ * (not written back to the pager): use vm_pagecache_sync()
+ * first to preserve modified pages.
+ */
+void vm_pagecache_destroy(struct vm_pagecache *obj)
+{
+	struct frame *frame;
+
+	mutex_lock(&s_pagecache_list_mutex);
+	while (obj->num_pins > 0) {
+		cond_wait(&s_pagecache_unpinned_cond, &s_pagecache_list_mutex);
+	}
+	vm_pagecache_list_remove(&s_pagecache_list, obj);
+	s_num_pagecaches--;
+	mutex_unlock(&s_pagecache_list_mutex);
+
+	mutex_lock(&obj->lock);
+
+	/* the frames of readahead reads in progress are still in use */
+	while (obj->num_readahead > 0) {
+		cond_wait(&obj->cond, &obj->lock);
+	}
+
+	while (!frame_list_is_empty(&obj->pagelist)) {
+		frame = frame_list_remove_first(&obj->pagelist);
+		KASSERT(frame->refcount == 0);
+		KASSERT(frame->content != PAGE_PENDING_INIT);
+		mem_free_frame(frame);
+	}
+
+	if (obj->radix_root != 0) {
+		vm_radix_free_node(obj->radix_root, obj->radix_height);
+	}
+	while (obj->radix_num_spare > 0) {
+		vm_radix_free_node(vm_radix_alloc_node(obj), 1);
+	}
+
+	mutex_unlock(&obj->lock);
+
+	mem_free(obj);
+}
+
 /*
  * Lock a page in a vm_pagecache.
  * A page cannot be stolen from its vm_pagecache
@@ -148,29 +1142,51 @@ int vm_pagecache_create(struct vm_pager *pager, struct vm_pagecache **p_obj)
  */
 int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
 {
-	int rc;
-	struct frame *frame;
+	int rc = 0;
+	struct frame *frame, *new_frame = 0;
 
 	mutex_lock(&obj->lock);
 
 	/*
 	 * See if page is already present.
 	 */
-	for (frame = frame_list_get_first(&obj->pagelist);
-	     frame != 0;
-	     frame = frame_list_next(frame)) {
-		if (frame->vm_pgcache_page_num == page_num) {
-			frame->refcount++; /* lock the frame! */
-			break;
-		}
+	frame = vm_radix_lookup(obj, page_num);
+	if (frame != 0) {
+		frame->refcount++; /* lock the frame! */
+		frame->referenced = true;
 	}
 
+	/*
+	 * If access is sequential, start reading the following pages
+	 * (before a miss blocks this thread on its own pagein).
+	 * This may release the lock while the reads are started,
+	 * but the frame (if present) is already locked.
+	 */
+	vm_readahead(obj, page_num);
+
 	if (frame == 0) {
 		/*
-		 * Page not present yet; allocate it and
-		 * page in its contents.
+		 * Page not present yet.  Get a frame for it (and the radix
+		 * tree nodes to index it) with the vm_pagecache unlocked,
+		 * since the pageout thread may need the lock to free one.
 		 */
-		rc = vm_alloc_and_page_in(obj, page_num, p_frame);
+		mutex_unlock(&obj->lock);
+		new_frame = mem_alloc_frame(FRAME_VM_PGCACHE, 0);
+		mutex_lock(&obj->lock);
+		vm_radix_reserve(obj, page_num, true);
+
+		/* another thread may have added the page in the meantime */
+		frame = vm_radix_lookup(obj, page_num);
+		if (frame != 0) {
+			frame->refcount++;
+			frame->referenced = true;
+		}
+	}
+
+	if (frame == 0) {
+		/* page in its contents */
+		rc = vm_alloc_and_page_in(obj, page_num, new_frame, p_frame);
+		new_frame = 0;
 	} else {
 		/*
 		 * Page is present; make sure its contents
@@ -192,6 +1208,11 @@ int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_fram
 
 	mutex_unlock(&obj->lock);
 
+	if (new_frame != 0) {
+		/* another thread added the page first */
+		mem_free_frame(new_frame);
+	}
+
 	return rc;
 }
 
@@ -210,9 +1231,128 @@ int vm_unlock_page(struct vm_pagecache *obj, struct frame *frame)
 
 	KASSERT(frame->refcount > 0);
 	frame->refcount--;
+	if (frame->refcount == 0) {
+		vm_frame_unlocked();
+	}
 
 	mutex_unlock(&obj->lock);
 
 	return rc;
 }
 
+/*
+ * Mark a locked page as modified, so that it will be written
+ * back to the pager.  Should be called after the page's contents
+ * are changed, before the page is unlocked.
+ */
+void vm_mark_page_dirty(struct vm_pagecache *obj, struct frame *frame)
+{
+	mutex_lock(&obj->lock);
+
+	KASSERT(frame->vm_pgcache == obj);
+	KASSERT(frame->refcount > 0);
+	KASSERT(frame->content == PAGE_CLEAN || frame->content == PAGE_DIRTY);
+
+	if (frame->content == PAGE_CLEAN) {
+		frame->content = PAGE_DIRTY;
+		obj->num_dirty++;
+	}
+
+	mutex_unlock(&obj->lock);
+}
+
+/*
+ * Write back all modified pages of a vm_pagecache,
+ * waiting for the writes to complete.
+ * Returns 0 if successful, or an error code if
+ * some page couldn't be written.
+ */
+int vm_pagecache_sync(struct vm_pagecache *obj)
+{
+	int rc;
+
+	mutex_lock(&obj->lock);
+	rc = vm_flush_pagecache(obj);
+	mutex_unlock(&obj->lock);
+
+	return rc;
+}
+
+/* ----------------------------------------------------------------------
+ * Benchmarks
+ * ---------------------------------------------------------------------- */
+
+static int vm_zero_pager_read_page(struct vm_pager *pager, void *buf, u32_t page_num)
+{
+	memset(buf, '\0', PAGE_SIZE);
+	return 0;
+}
+
+static int vm_zero_pager_write_page(struct vm_pager *pager, void *buf, u32_t page_num)
+{
+	return 0;
+}
+
+static struct vm_pager_ops s_zero_pager_ops = {
+	.read_page = &vm_zero_pager_read_page,
+	.write_page = &vm_zero_pager_write_page,
+};
+
+/*
+ * Measure the latency of vm_lock_page()/vm_unlock_page() hits
+ * with given number of resident pages.
+ */
+static void vm_bench_lock_page_hits(struct vm_pager *pager, u32_t num_pages)
+{
+	struct vm_pagecache *obj;
+	struct frame *frame;
+	u32_t i, page_num;
+	u64_t start, elapsed;
+	const u32_t num_iters = 10000;
+
+	/* leave some frames for the rest of the kernel */
+	if (num_pages + 256 > mem_get_num_free_frames()) {
+		cons_printf("  %lu pages: skipped (not enough memory)\n", num_pages);
+		return;
+	}
+
+	vm_pagecache_create(pager, &obj);
+
+	/* make all pages resident */
+	for (i = 0; i < num_pages; i++) {
+		vm_lock_page(obj, i, &frame);
+		vm_unlock_page(obj, frame);
+	}
+
+	/* lock and unlock pages, visiting them in a scattered order */
+	start = timer_read_cycles();
+	for (i = 0; i < num_iters; i++) {
+		page_num = (i * 7919) % num_pages;
+		vm_lock_page(obj, page_num, &frame);
+		vm_unlock_page(obj, frame);
+	}
+	elapsed = timer_read_cycles() - start;
+
+	cons_printf("  %lu pages: %lu cycles per lock_page hit\n",
+		num_pages, ((u32_t) elapsed) / num_iters);
+
+	vm_pagecache_destroy(obj);
+}
+
+/*
+ * vm_lock_page() hit latency as a function of the number of
+ * resident pages in the vm_pagecache.
+ */
+void vm_pagecache_benchmark(void)
+{
+	struct vm_pager *pager;
+
+	vm_pager_create(&s_zero_pager_ops, 0, &pager);
+
+	cons_printf("vm_pagecache lock_page benchmark:\n");
+	vm_bench_lock_page_hits(pager, 10);
+	vm_bench_lock_page_hits(pager, 1000);
+	vm_bench_lock_page_hits(pager, 100000);
+
+	mem_free(pager);
+}
@@ -22,6 +22,7 @@
 #include <geekos/thread.h>
 #include <geekos/int.h>
 #include <geekos/mem.h>
+#include <geekos/slab.h>
 #include <geekos/kassert.h>
 
 struct workqueue_item;
@@ -32,6 +33,8 @@ struct workqueue_item {
 	struct workqueue_item *next;
 };
 
+static struct slab_cache s_item_cache = SLAB_CACHE_INITIALIZER("workqueue_item", sizeof(struct workqueue_item));
+
 /* queue of workqueue items */
 struct workqueue_item *s_workqueue_head, *s_workqueue_tail;
 
@@ -64,7 +67,7 @@ static void workqueue_thread(ulong_t arg)
 
 		/* do the work and delete the item */
 		item->callback(item->data);
-		mem_free(item);
+		slab_free(&s_item_cache, item);
 	}
 }
 
@@ -85,7 +88,7 @@ void workqueue_schedule_work(void (*callback)(void *), void *data)
 	struct workqueue_item *item;
 
 	/* create new item */
-	item = mem_alloc(sizeof(struct workqueue_item));
+	item = slab_alloc(&s_item_cache);
 	item->callback = callback;
 	item->data = data;
 	item->next = 0;
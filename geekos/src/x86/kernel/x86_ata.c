@@ -21,23 +21,60 @@
 
 #include <geekos/types.h>
 #include <geekos/cons.h>
+#include <geekos/blockdev.h>
+#include <geekos/dev.h>
+#include <geekos/irq.h>
+#include <geekos/mem.h>
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/range.h>
 #include <arch/ioport.h>
+#include <arch/pci.h>
+#include <arch/ata.h>
+
+/*
+ * NOTES:
+ * - Only the master drive on the primary channel is supported.
+ *   It is registered as the "ata0" block device.
+ * - Requests are interrupt driven.  If the IDE controller supports
+ *   PCI bus mastering, data is transferred by DMA; otherwise,
+ *   data is transferred by PIO using READ/WRITE MULTIPLE,
+ *   with one interrupt per block of sectors.
+ * - The blockdev request queue passes one request at a time
+ *   to the driver.  Requests that are larger than one ATA command
+ *   can transfer are split into several commands.
+ * - The driver state is shared with the interrupt handler,
+ *   so it is only accessed with interrupts disabled.
+ */
 
 /* Registers */
 #define ATA_DATA_REG		0x1F0
 #define ATA_ERROR_REG		0x1F1
+#define ATA_FEATURES_REG	0x1F1
+#define ATA_SECTOR_COUNT_REG	0x1F2
+#define ATA_LBA_LOW_REG		0x1F3
+#define ATA_LBA_MID_REG		0x1F4
+#define ATA_LBA_HIGH_REG	0x1F5
 #define ATA_DRIVE_HEAD_REG	0x1F6
 #define ATA_STATUS_REG		0x1F7
 #define ATA_CMD_REG		0x1F7
 #define ATA_DEV_CTRL_REG	0x3F6
 
+#define ATA_IRQ 14
+
 /* Bits of Device Control Register */
 #define ATA_DCR_NOINTERRUPT	(1 << 1) 
 #define ATA_DCR_RESET		(1 << 2)
 
+/* Bits of Drive/Head Register */
+#define ATA_DRIVE_HEAD_LBA	(1 << 6)
+#define ATA_DRIVE_HEAD_OBS	0xA0	/* obsolete bits that must be set */
+
 /* bits of Status Register */
-#define ATA_STATUS_DRIVE_BUSY	(1 << 7)
+#define ATA_STATUS_ERROR	(1 << 0)
 #define ATA_STATUS_DRIVE_DATA_REQUEST	(1 << 3)
+#define ATA_STATUS_DRIVE_FAULT	(1 << 5)
+#define ATA_STATUS_DRIVE_BUSY	(1 << 7)
 
 /* words from Identify Drive Request (offsets) */
 #define	ATA_INDENT_NUM_CYLINDERS	0x01
@@ -45,40 +82,491 @@
 #define	ATA_INDENT_NUM_BYTES_TRACK	0x04
 #define	ATA_INDENT_NUM_BYTES_SECTOR	0x05
 #define	ATA_INDENT_NUM_SECTORS_TRACK 0x06
+#define	ATA_INDENT_MAX_MULTIPLE		47	/* low byte: max sectors per READ/WRITE MULTIPLE block */
+#define	ATA_INDENT_CAPABILITIES		49
+#define	ATA_INDENT_LBA28_SECTORS	60	/* 2 words */
+#define	ATA_INDENT_COMMAND_SETS		83
+#define	ATA_INDENT_LBA48_SECTORS	100	/* 4 words */
+
+/* bits of identify words */
+#define ATA_CAP_DMA		(1 << 8)
+#define ATA_CAP_LBA		(1 << 9)
+#define ATA_CMDSET_LBA48	(1 << 10)
 
 /* Commands */
 #define ATA_CMD_IDENTIFY_DRIVE	0xEC
 #define ATA_CMD_DIAGNOSTIC		0x90
+#define ATA_CMD_SET_MULTIPLE	0xC6
+#define ATA_CMD_READ_SECTORS	0x20
+#define ATA_CMD_READ_SECTORS_EXT	0x24
+#define ATA_CMD_WRITE_SECTORS	0x30
+#define ATA_CMD_WRITE_SECTORS_EXT	0x34
+#define ATA_CMD_READ_MULTIPLE	0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT	0x29
+#define ATA_CMD_WRITE_MULTIPLE	0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT	0x39
+#define ATA_CMD_READ_DMA	0xC8
+#define ATA_CMD_READ_DMA_EXT	0x25
+#define ATA_CMD_WRITE_DMA	0xCA
+#define ATA_CMD_WRITE_DMA_EXT	0x35
+
+/* Bus master IDE registers (offsets from the bus master base port) */
+#define ATA_BM_CMD_REG		0x0
+#define ATA_BM_STATUS_REG	0x2
+#define ATA_BM_PRD_REG		0x4
+
+/* bits of Bus Master Command/Status Registers */
+#define ATA_BM_CMD_START	(1 << 0)
+#define ATA_BM_CMD_READ		(1 << 3)	/* transfer from device to memory */
+#define ATA_BM_STATUS_ERROR	(1 << 1)
+#define ATA_BM_STATUS_IRQ	(1 << 2)
+
+#define ATA_SECTOR_SIZE		512
+#define ATA_LBA28_MAX		0x0FFFFFFFUL	/* largest LBA addressable with LBA28 */
+#define ATA_MAX_SECTORS_PER_CMD	256		/* sectors transferred by one command */
+#define ATA_POLL_LIMIT		1000000
+
+/*
+ * Physical Region Descriptor: one contiguous piece of memory
+ * for a DMA transfer.  Must not cross a 64K boundary.
+ */
+struct ata_prd {
+	u32_t addr;
+	u16_t size;   /* in bytes; 0 means 64K */
+	u16_t flags;
+} __attribute__((packed));
+
+#define ATA_PRD_EOT		0x8000	/* last entry in PRD table */
+#define ATA_MAX_PRDS		(PAGE_SIZE / sizeof(struct ata_prd))
+
+/*
+ * Drive parameters and state of the request in progress.
+ */
+struct ata_drive {
+	int drive;                  /* 0 = master, 1 = slave */
+	u32_t num_sectors;          /* capacity */
+	bool lba48;                 /* drive supports 48 bit LBAs */
+	unsigned multiple;          /* sectors per PIO block (0 if READ/WRITE MULTIPLE unsupported) */
+	u16_t bm_base;              /* bus master base port (0 if DMA is not used) */
+	struct ata_prd *prd_table;  /* PRD table for DMA */
+
+	struct blockdev_req *req;   /* request in progress, or null */
+	u32_t lba;                  /* first sector of current command */
+	unsigned num_left;          /* sectors of the request not yet completed */
+	unsigned cmd_sectors;       /* sectors transferred by current command */
+	unsigned cmd_left;          /* PIO: sectors of current command not yet transferred */
+	unsigned seg;               /* current request buffer segment */
+	size_t seg_off;             /* offset in current buffer segment */
+};
+
+static struct ata_drive s_ata;
+
+/*
+ * Wait for the drive to become not busy.
+ * Returns the status register value, or -1 on timeout.
+ */
+static int ata_wait_not_busy(void)
+{
+	u8_t status;
+	int i;
+
+	for (i = 0; i < ATA_POLL_LIMIT; i++) {
+		status = ioport_inb(ATA_STATUS_REG);
+		if (!(status & ATA_STATUS_DRIVE_BUSY)) {
+			return status;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Issue a command that transfers data to/from given range of sectors.
+ */
+static void ata_issue_command(struct ata_drive *ata, u8_t cmd, u32_t lba, unsigned count, bool lba48)
+{
+	KASSERT(count > 0 && count <= ATA_MAX_SECTORS_PER_CMD);
 
-static int ata_read_drive_config(int drive)
+	ata_wait_not_busy();
+
+	if (lba48) {
+		ioport_outb(ATA_DRIVE_HEAD_REG, ATA_DRIVE_HEAD_LBA | (ata->drive << 4));
+		/* high order bytes first, then low order bytes */
+		ioport_outb(ATA_SECTOR_COUNT_REG, (count >> 8) & 0xFF);
+		ioport_outb(ATA_LBA_LOW_REG, (lba >> 24) & 0xFF);
+		ioport_outb(ATA_LBA_MID_REG, 0);
+		ioport_outb(ATA_LBA_HIGH_REG, 0);
+		ioport_outb(ATA_SECTOR_COUNT_REG, count & 0xFF);
+		ioport_outb(ATA_LBA_LOW_REG, lba & 0xFF);
+		ioport_outb(ATA_LBA_MID_REG, (lba >> 8) & 0xFF);
+		ioport_outb(ATA_LBA_HIGH_REG, (lba >> 16) & 0xFF);
+	} else {
+		ioport_outb(ATA_DRIVE_HEAD_REG,
+			ATA_DRIVE_HEAD_OBS | ATA_DRIVE_HEAD_LBA | (ata->drive << 4) | ((lba >> 24) & 0x0F));
+		ioport_outb(ATA_SECTOR_COUNT_REG, count & 0xFF); /* 0 means 256 */
+		ioport_outb(ATA_LBA_LOW_REG, lba & 0xFF);
+		ioport_outb(ATA_LBA_MID_REG, (lba >> 8) & 0xFF);
+		ioport_outb(ATA_LBA_HIGH_REG, (lba >> 16) & 0xFF);
+	}
+
+	ioport_outb(ATA_CMD_REG, cmd);
+}
+
+/*
+ * Transfer given number of sectors between the data register
+ * and the request's buffer segments (PIO).
+ */
+static void ata_pio_transfer(struct ata_drive *ata, unsigned num_sectors)
+{
+	struct blockdev_req *req = ata->req;
+	size_t num_bytes = num_sectors * ATA_SECTOR_SIZE;
+	struct blockdev_seg *seg;
+	size_t len;
+
+	while (num_bytes > 0) {
+		KASSERT(ata->seg < req->num_segs);
+		seg = &req->segs[ata->seg];
+		len = seg->size - ata->seg_off;
+		if (len > num_bytes) {
+			len = num_bytes;
+		}
+		KASSERT((len & 1) == 0);
+
+		if (req->type == BLOCKDEV_REQ_READ) {
+			ioport_insw(ATA_DATA_REG, (char *) seg->buf + ata->seg_off, len / 2);
+		} else {
+			ioport_outsw(ATA_DATA_REG, (char *) seg->buf + ata->seg_off, len / 2);
+		}
+
+		num_bytes -= len;
+		ata->seg_off += len;
+		if (ata->seg_off == seg->size) {
+			ata->seg++;
+			ata->seg_off = 0;
+		}
+	}
+}
+
+/*
+ * Fill in the PRD table to transfer given number of sectors
+ * to/from the request's buffer segments (DMA), and prepare
+ * the bus master for the transfer.
+ */
+static void ata_dma_setup(struct ata_drive *ata, unsigned num_sectors)
+{
+	struct blockdev_req *req = ata->req;
+	size_t num_bytes = num_sectors * ATA_SECTOR_SIZE;
+	struct blockdev_seg *seg;
+	u32_t addr, len, boundary;
+	unsigned n = 0;
+
+	while (num_bytes > 0) {
+		KASSERT(ata->seg < req->num_segs);
+		seg = &req->segs[ata->seg];
+		addr = (u32_t) seg->buf + ata->seg_off; /* kernel memory is identity mapped */
+		len = seg->size - ata->seg_off;
+		if (len > num_bytes) {
+			len = num_bytes;
+		}
+
+		/* a PRD can't cross a 64K boundary */
+		boundary = 0x10000 - (addr & 0xFFFF);
+		if (len > boundary) {
+			len = boundary;
+		}
+
+		KASSERT(n < ATA_MAX_PRDS);
+		KASSERT((addr & 1) == 0);
+		ata->prd_table[n].addr = addr;
+		ata->prd_table[n].size = len & 0xFFFF;
+		ata->prd_table[n].flags = 0;
+		n++;
+
+		num_bytes -= len;
+		ata->seg_off += len;
+		if (ata->seg_off == seg->size) {
+			ata->seg++;
+			ata->seg_off = 0;
+		}
+	}
+	ata->prd_table[n - 1].flags = ATA_PRD_EOT;
+
+	ioport_outl(ata->bm_base + ATA_BM_PRD_REG, (u32_t) ata->prd_table);
+	ioport_outb(ata->bm_base + ATA_BM_CMD_REG, (req->type == BLOCKDEV_REQ_READ) ? ATA_BM_CMD_READ : 0);
+	/* clear error and interrupt bits by writing 1s */
+	ioport_outb(ata->bm_base + ATA_BM_STATUS_REG,
+		ioport_inb(ata->bm_base + ATA_BM_STATUS_REG) | ATA_BM_STATUS_ERROR | ATA_BM_STATUS_IRQ);
+}
+
+/*
+ * Start the next command of the request in progress.
+ */
+static void ata_start_command(struct ata_drive *ata)
 {
-	int status, i;
+	struct blockdev_req *req = ata->req;
+	bool read = (req->type == BLOCKDEV_REQ_READ);
+	unsigned count;
+	bool lba48;
+	u8_t cmd;
+
+	KASSERT(!int_enabled());
+
+	count = ata->num_left;
+	if (count > ATA_MAX_SECTORS_PER_CMD) {
+		count = ATA_MAX_SECTORS_PER_CMD;
+	}
+	lba48 = (ata->lba + count - 1 > ATA_LBA28_MAX);
+	ata->cmd_sectors = ata->cmd_left = count;
+
+	if (ata->bm_base != 0) {
+		ata_dma_setup(ata, count);
+		if (read) {
+			cmd = lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+		} else {
+			cmd = lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+		}
+		ata_issue_command(ata, cmd, ata->lba, count, lba48);
+		ioport_outb(ata->bm_base + ATA_BM_CMD_REG,
+			ioport_inb(ata->bm_base + ATA_BM_CMD_REG) | ATA_BM_CMD_START);
+		return;
+	}
+
+	if (ata->multiple > 0) {
+		if (read) {
+			cmd = lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+		} else {
+			cmd = lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+		}
+	} else {
+		if (read) {
+			cmd = lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+		} else {
+			cmd = lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+		}
+	}
+	ata_issue_command(ata, cmd, ata->lba, count, lba48);
+
+	if (!read) {
+		/* the drive doesn't interrupt before the first block of a write */
+		ata_wait_not_busy();
+		count = ata->multiple > 0 ? range_umin(ata->multiple, ata->cmd_left) : 1;
+		ata_pio_transfer(ata, count);
+		ata->cmd_left -= count;
+	}
+}
+
+/*
+ * ATA interrupt handler.
+ * Called when a block of sectors has been transferred (PIO)
+ * or when a command completes.
+ */
+static void ata_int_handler(struct thread_context *context)
+{
+	struct ata_drive *ata = &s_ata;
+	struct blockdev_req *req = ata->req;
+	u8_t status, bm_status = 0;
+	unsigned count;
+	int rc = 0;
+
+	irq_begin(context);
+
+	if (ata->bm_base != 0) {
+		bm_status = ioport_inb(ata->bm_base + ATA_BM_STATUS_REG);
+		ioport_outb(ata->bm_base + ATA_BM_CMD_REG,
+			ioport_inb(ata->bm_base + ATA_BM_CMD_REG) & ~ATA_BM_CMD_START);
+		ioport_outb(ata->bm_base + ATA_BM_STATUS_REG, bm_status | ATA_BM_STATUS_ERROR | ATA_BM_STATUS_IRQ);
+	}
+
+	/* reading the status register acknowledges the interrupt */
+	status = ioport_inb(ATA_STATUS_REG);
+
+	if (req == 0) {
+		goto done; /* spurious */
+	}
+
+	if ((status & (ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)) || (bm_status & ATA_BM_STATUS_ERROR)) {
+		rc = EIO;
+		goto finish;
+	}
+
+	if (ata->bm_base == 0 && ata->cmd_left > 0) {
+		/* PIO: transfer the next block of sectors */
+		count = ata->multiple > 0 ? range_umin(ata->multiple, ata->cmd_left) : 1;
+		ata_pio_transfer(ata, count);
+		ata->cmd_left -= count;
+
+		/* for a write, the command isn't complete until the drive
+		 * interrupts after the last block; for a read, it is
+		 * complete once the last block has been read */
+		if (req->type == BLOCKDEV_REQ_WRITE || ata->cmd_left > 0) {
+			goto done;
+		}
+	}
+
+	/* the current command is complete */
+	ata->lba += ata->cmd_sectors;
+	ata->num_left -= ata->cmd_sectors;
+	if (ata->num_left > 0) {
+		ata_start_command(ata);
+		goto done;
+	}
+
+finish:
+	ata->req = 0;
+	blockdev_notify_complete(req, rc);
+
+done:
+	irq_end(context);
+}
+
+/* ----------------------------------------------------------------------
+ * Block device operations
+ * ---------------------------------------------------------------------- */
+
+static void ata_post_request(struct blockdev *dev, struct blockdev_req *req)
+{
+	struct ata_drive *ata = dev->data;
+	bool iflag;
+
+	if (!lba_is_range_valid(req->lba, req->num_blocks, ata->num_sectors)) {
+		blockdev_notify_complete(req, EINVAL);
+		return;
+	}
+	if (req->num_blocks == 0) {
+		blockdev_notify_complete(req, 0);
+		return;
+	}
+
+	iflag = int_begin_atomic();
+	KASSERT(ata->req == 0);
+	ata->req = req;
+	ata->lba = lba_num(req->lba);
+	ata->num_left = req->num_blocks;
+	ata->seg = 0;
+	ata->seg_off = 0;
+	ata_start_command(ata);
+	int_end_atomic(iflag);
+}
+
+static ulong_t ata_get_num_blocks(struct blockdev *dev)
+{
+	return ((struct ata_drive *) dev->data)->num_sectors;
+}
+
+static blocksize_t ata_get_block_size(struct blockdev *dev)
+{
+	return blocksize_from_size(ATA_SECTOR_SIZE);
+}
+
+/*
+ * The drive is registered once at boot and shared by all of
+ * its users, so closing it just drops the caller's handle:
+ * the device stays usable, and other users' requests
+ * in progress are unaffected.
+ */
+static int ata_close(struct blockdev *dev)
+{
+	return 0;
+}
+
+static struct blockdev_ops s_ata_blockdev_ops = {
+	.post_request = &ata_post_request,
+	.close = &ata_close,
+	.get_num_blocks = &ata_get_num_blocks,
+	.get_block_size = &ata_get_block_size,
+};
+
+/* ----------------------------------------------------------------------
+ * Initialization
+ * ---------------------------------------------------------------------- */
+
+static int ata_read_drive_config(struct ata_drive *ata)
+{
+	int status;
 	u16_t info[256];
 	u16_t num_cylinders, num_heads, num_sectors;
-	ioport_outb(ATA_DRIVE_HEAD_REG, 0xA0 + (drive << 4));
+	ioport_outb(ATA_DRIVE_HEAD_REG, 0xA0 + (ata->drive << 4));
 	ioport_outb(ATA_CMD_REG, ATA_CMD_IDENTIFY_DRIVE);
 	while (ioport_inb(ATA_STATUS_REG) & ATA_STATUS_DRIVE_BUSY)
 		;
 	status = ioport_inb(ATA_STATUS_REG);
 
 	if (status & ATA_STATUS_DRIVE_DATA_REQUEST) {
-		for (i = 0; i < 256; ++i) 
-			info[i] = ioport_inw(ATA_DATA_REG);
+		ioport_insw(ATA_DATA_REG, info, 256);
 		num_cylinders = info[ATA_INDENT_NUM_CYLINDERS];
 		num_heads     = info[ATA_INDENT_NUM_HEADS];
 		num_sectors   = info[ATA_INDENT_NUM_SECTORS_TRACK];
 		/*num_bytes_per_sector = info[ATA_INDENT_NUM_BYTES_SECTOR];*/
-		cons_printf("  Found ATA drive %d", drive);
+		cons_printf("  Found ATA drive %d", ata->drive);
 		cons_printf(": cyl=%d, heads=%d, sectors=%d\n", 
 				num_cylinders, num_heads, num_sectors);
 	} else
 		return -1;
-	return 0;
+
+	if (!(info[ATA_INDENT_CAPABILITIES] & ATA_CAP_LBA)) {
+		cons_printf("  ATA drive %d doesn't support LBA\n", ata->drive);
+		return -1;
+	}
+
+	ata->lba48 = (info[ATA_INDENT_COMMAND_SETS] & ATA_CMDSET_LBA48) != 0;
+	if (ata->lba48 && info[ATA_INDENT_LBA48_SECTORS + 2] == 0 && info[ATA_INDENT_LBA48_SECTORS + 3] == 0) {
+		ata->num_sectors = info[ATA_INDENT_LBA48_SECTORS] | ((u32_t) info[ATA_INDENT_LBA48_SECTORS + 1] << 16);
+	} else if (ata->lba48) {
+		ata->num_sectors = 0xFFFFFFFFUL; /* more than lba_t can address */
+	} else {
+		ata->num_sectors = info[ATA_INDENT_LBA28_SECTORS] | ((u32_t) info[ATA_INDENT_LBA28_SECTORS + 1] << 16);
+	}
+
+	/* enable READ/WRITE MULTIPLE with the largest block size the drive supports */
+	ata->multiple = info[ATA_INDENT_MAX_MULTIPLE] & 0xFF;
+	if (ata->multiple > 0) {
+		ioport_outb(ATA_DRIVE_HEAD_REG, ATA_DRIVE_HEAD_OBS | (ata->drive << 4));
+		ioport_outb(ATA_SECTOR_COUNT_REG, ata->multiple);
+		ioport_outb(ATA_CMD_REG, ATA_CMD_SET_MULTIPLE);
+		status = ata_wait_not_busy();
+		if (status < 0 || (status & ATA_STATUS_ERROR)) {
+			ata->multiple = 0;
+		}
+	}
+
+	return (info[ATA_INDENT_CAPABILITIES] & ATA_CAP_DMA) ? 1 : 0;
+}
+
+/*
+ * Find the PCI IDE controller, and if it supports bus mastering,
+ * enable it.  Returns the bus master base port for the primary
+ * channel, or 0 if DMA can't be used.
+ */
+static u16_t ata_find_bus_master(void)
+{
+	struct pci_func pf;
+	u32_t bar;
+
+	if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pf)) {
+		return 0;
+	}
+
+	/* bit 7 of the programming interface byte indicates bus master support */
+	if (!(pci_config_read(&pf, PCI_REG_CLASS) & (1UL << 15))) {
+		return 0;
+	}
+
+	bar = pci_config_read(&pf, PCI_REG_BAR(4));
+	if (!(bar & 1)) {
+		return 0; /* not an I/O port BAR */
+	}
+
+	pci_config_write(&pf, PCI_REG_COMMAND,
+		pci_config_read(&pf, PCI_REG_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	return bar & 0xFFFC;
 }
 
 void ata_init(void)
 {
 	int i, error;
+	struct ata_drive *ata = &s_ata;
+	struct blockdev *dev;
+
 	/* Reset the controller and drives */
 	ioport_outb(ATA_DEV_CTRL_REG, ATA_DCR_NOINTERRUPT | ATA_DCR_RESET);
 	for (i = 0; i < 5; ++i) ioport_inb(ATA_STATUS_REG); /* delay for 500ms */
@@ -92,6 +580,31 @@ void ata_init(void)
 		;
 	error = ioport_inb(ATA_ERROR_REG);
 
-    error = ata_read_drive_config(0);
-	if (error) cons_printf("Ata_init: No drive found\n");
+	ata->drive = 0;
+	error = ata_read_drive_config(ata);
+	if (error < 0) {
+		cons_printf("Ata_init: No drive found\n");
+		return;
+	}
+
+	/* use DMA if both the drive and the controller support it */
+	if (error > 0) {
+		ata->bm_base = ata_find_bus_master();
+	}
+	if (ata->bm_base != 0) {
+		ata->prd_table = mem_frame_to_pa(mem_alloc_frame(FRAME_KERN, 1));
+	}
+
+	cons_printf("  ATA drive %d: %lu sectors, %s\n", ata->drive, ata->num_sectors,
+		ata->bm_base != 0 ? "DMA" : (ata->multiple > 0 ? "PIO (multiple)" : "PIO"));
+
+	/* from now on, the drive interrupts when commands complete */
+	irq_install_handler(ATA_IRQ, &ata_int_handler);
+	irq_enable(ATA_IRQ);
+	ioport_outb(ATA_DEV_CTRL_REG, 0);
+
+	dev = blockdev_create(&s_ata_blockdev_ops, ata);
+	if (dev_register_blockdev("ata0", dev) != 0) {
+		cons_printf("Ata_init: couldn't register ata0\n");
+	}
 }
@@ -20,6 +20,7 @@
 #include <geekos/types.h>
 #include <geekos/string.h>
 #include <geekos/kassert.h>
+#include <geekos/smp.h>
 #include <arch/cpu.h>
 
 /* segment descriptor constants (upper word) */
@@ -33,10 +34,12 @@
 
 /* -------------------- Private -------------------- */
 
-#define GDT_LEN 4
+/* null, kernel code, kernel data, TSS, and one per-CPU data segment per CPU */
+#define GDT_LEN (KERN_PERCPU_FIRST_INDEX + CPU_MAX)
 
 static struct x86_segment_descriptor s_gdt[GDT_LEN];
 static struct x86_tss s_tss;
+static u16_t s_gdtr[3];
 
 #if 0
 static void dump_gdt(void)
@@ -104,12 +107,22 @@ void x86_init_int_gate(struct x86_interrupt_gate *gate, ulong_t addr, int dpl)
 	gate->offset_high = addr >> 16;
 }
 
+/*
+ * Load the %gs register with the selector of given CPU's
+ * per-CPU data segment.
+ */
+static void x86_seg_load_percpu(int cpu_id)
+{
+	u16_t sel = KERN_PERCPU_SEL(cpu_id);
+	__asm__ __volatile__ ("movw %0, %%gs" : : "r" (sel));
+}
+
 /*
  * Create the GeekOS GDT.
  */
 void x86_seg_init_gdt(void)
 {
-	u16_t limit_and_base[3];
+	int i;
 
 	KASSERT(sizeof(struct x86_segment_descriptor) == 8);
 
@@ -120,11 +133,40 @@ void x86_seg_init_gdt(void)
 	x86_seg_init_tss(&s_gdt[3], &s_tss);
 	/* TODO: user code/data */
 
+	/* per-CPU data segments */
+	smp_init_cpus();
+	for (i = 0; i < CPU_MAX; i++) {
+		x86_seg_init_data(&s_gdt[KERN_PERCPU_FIRST_INDEX + i], (u32_t) &g_cpus[i], 1, PRIV_KERN);
+	}
+
 	/* load the GDTR */
-	limit_and_base[0] = sizeof(s_gdt);            /* size of GDT */
-	limit_and_base[1] = ((u32_t) s_gdt) & 0xFFFF; /* low 16 bits of base addr */
-	limit_and_base[2] = ((u32_t) s_gdt) >> 16;    /* high 16 bits of base addr */
-	x86_load_gdtr(limit_and_base);
+	s_gdtr[0] = sizeof(s_gdt);            /* size of GDT */
+	s_gdtr[1] = ((u32_t) s_gdt) & 0xFFFF; /* low 16 bits of base addr */
+	s_gdtr[2] = ((u32_t) s_gdt) >> 16;    /* high 16 bits of base addr */
+	x86_load_gdtr(s_gdtr);
+
+	/* the bootstrap processor is CPU 0 */
+	x86_seg_load_percpu(0);
+}
+
+/*
+ * Load the GeekOS GDT on an application processor,
+ * and point its %gs segment at its per-CPU data.
+ */
+void x86_seg_load_gdt_ap(int cpu_id)
+{
+	x86_load_gdtr(s_gdtr);
+	x86_seg_load_percpu(cpu_id);
+}
+
+/*
+ * Get the contents of the GDTR, for starting application processors.
+ */
+void x86_seg_get_gdtr(u16_t *limit_and_base)
+{
+	limit_and_base[0] = s_gdtr[0];
+	limit_and_base[1] = s_gdtr[1];
+	limit_and_base[2] = s_gdtr[2];
 }
 
 /*
@@ -21,6 +21,7 @@
 #include <geekos/types.h>
 #include <geekos/kassert.h>
 #include <geekos/int.h>
+#include <geekos/smp.h>
 #include <arch/cpu.h>
 #include <arch/thread.h>
 #include <arch/int.h>
@@ -41,7 +42,6 @@ void int_init(void)
 	extern char int_handler_stub_vector, int_handler_stub_vector_end;
 	int num_handler_stubs = (&int_handler_stub_vector_end - &int_handler_stub_vector);
 	int i;
-	u16_t limit_and_base[3];
 
 	PANIC_IF(num_handler_stubs / INT_HANDLER_STUB_LEN != INT_NUM_INTERRUPTS,
 		"Interrupt handler stub vector has unexpected size");
@@ -52,10 +52,7 @@ void int_init(void)
 		x86_init_int_gate(&s_idt[i],
 			(ulong_t) (&int_handler_stub_vector + stub_offset), PRIV_KERN);
 	}
-	limit_and_base[0] = sizeof(s_idt);
-	limit_and_base[1] = ((ulong_t) s_idt) & 0xFFFF;
-	limit_and_base[2] = ((ulong_t) s_idt) >> 16;
-	x86_load_idtr(limit_and_base);
+	int_load_idt();
 
 	/* initialize C interrupt handler function table */
 	for (i = 0; i < INT_NUM_INTERRUPTS; i++) {
@@ -63,6 +60,19 @@ void int_init(void)
 	}
 }
 
+/*
+ * Load the IDT on the calling CPU.
+ */
+void int_load_idt(void)
+{
+	u16_t limit_and_base[3];
+
+	limit_and_base[0] = sizeof(s_idt);
+	limit_and_base[1] = ((ulong_t) s_idt) & 0xFFFF;
+	limit_and_base[2] = ((ulong_t) s_idt) >> 16;
+	x86_load_idtr(limit_and_base);
+}
+
 void int_install_handler(int int_num, int_handler_t *handler)
 {
 	KASSERT(int_num >= 0 && int_num < INT_NUM_INTERRUPTS);
@@ -86,6 +96,13 @@ void int_disable__(void)
 	__asm__ __volatile__ ("cli");
 }
 
+void int_wait__(void)
+{
+	/* sti delays recognition of interrupts until after the next instruction */
+	smp_unlock_kernel();
+	__asm__ __volatile__ ("sti; hlt");
+}
+
 #if 0
 void int_dump_stack_word(u32_t *addr, u32_t word)
 {
@@ -0,0 +1,117 @@
+/*
+ * GeekOS - x86 IO APIC
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/types.h>
+#include <geekos/kassert.h>
+#include <geekos/cons.h>
+#include <arch/vm.h>
+#include <arch/ioapic.h>
+
+/*
+ * The IO APIC has two memory-mapped registers: a register
+ * select register, and a window through which the selected
+ * register is read or written.
+ */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+/* indirect registers */
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIR   0x10   /* two registers per pin */
+
+/* bits in the low word of a redirection table entry */
+#define IOAPIC_MASKED (1 << 16)
+
+/* virtual address of the IO APIC registers */
+static volatile u8_t *s_ioapic;
+
+/* number of input pins */
+static int s_num_pins;
+
+/* low words of the redirection table entries */
+static u32_t s_redir[256];
+
+static u32_t ioapic_read(u32_t reg)
+{
+	*((volatile u32_t *) (s_ioapic + IOAPIC_REGSEL)) = reg;
+	return *((volatile u32_t *) (s_ioapic + IOAPIC_WINDOW));
+}
+
+static void ioapic_write(u32_t reg, u32_t value)
+{
+	*((volatile u32_t *) (s_ioapic + IOAPIC_REGSEL)) = reg;
+	*((volatile u32_t *) (s_ioapic + IOAPIC_WINDOW)) = value;
+}
+
+/*
+ * Map the IO APIC registers at given physical address,
+ * and mask all of its inputs.
+ */
+void ioapic_init(ulong_t paddr)
+{
+	int pin;
+
+	x86_vm_map_io(paddr);
+	s_ioapic = (volatile u8_t *) paddr;
+	s_num_pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+
+	for (pin = 0; pin < s_num_pins; pin++) {
+		s_redir[pin] = IOAPIC_MASKED;
+		ioapic_write(IOAPIC_REDIR + 2*pin, s_redir[pin]);
+		ioapic_write(IOAPIC_REDIR + 2*pin + 1, 0);
+	}
+
+	cons_printf("IO APIC version %lx, %d pins\n", ioapic_read(IOAPIC_VERSION) & 0xFF, s_num_pins);
+}
+
+int ioapic_num_pins(void)
+{
+	return s_num_pins;
+}
+
+/*
+ * Route given input pin to given vector on the CPU with given
+ * local APIC id.  The mode is a combination of IOAPIC_ACTIVE_LOW
+ * and IOAPIC_LEVEL.  The pin's mask is unchanged.
+ * Interrupts must be disabled.
+ */
+void ioapic_route(int pin, int vector, u32_t mode, int apic_id)
+{
+	KASSERT(pin >= 0 && pin < s_num_pins);
+
+	s_redir[pin] = (s_redir[pin] & IOAPIC_MASKED) | mode | vector;
+	ioapic_write(IOAPIC_REDIR + 2*pin + 1, ((u32_t) apic_id) << 24);
+	ioapic_write(IOAPIC_REDIR + 2*pin, s_redir[pin]);
+}
+
+/*
+ * Mask or unmask given input pin.
+ * Interrupts must be disabled.
+ */
+void ioapic_set_masked(int pin, bool masked)
+{
+	KASSERT(pin >= 0 && pin < s_num_pins);
+
+	if (masked) {
+		s_redir[pin] |= IOAPIC_MASKED;
+	} else {
+		s_redir[pin] &= ~IOAPIC_MASKED;
+	}
+	ioapic_write(IOAPIC_REDIR + 2*pin, s_redir[pin]);
+}
@@ -58,6 +58,22 @@ void ioport_outl(u16_t port, u32_t value)
 	__asm__ __volatile__ ("outl %0, %w1" : : "a" (value), "Nd" (port));
 }
 
+/*
+ * Read count 16 bit words from given port into a buffer.
+ */
+void ioport_insw(u16_t port, void *buf, ulong_t count)
+{
+	__asm__ __volatile__ ("cld; rep insw" : "+D" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
+/*
+ * Write count 16 bit words from a buffer to given port.
+ */
+void ioport_outsw(u16_t port, const void *buf, ulong_t count)
+{
+	__asm__ __volatile__ ("cld; rep outsw" : "+S" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
 void ioport_delay(void)
 {
     u8_t value = 0;
@@ -21,7 +21,11 @@
 #include <stdbool.h>
 #include <geekos/types.h>
 #include <geekos/irq.h>
+#include <geekos/smp.h>
+#include <geekos/cons.h>
 #include <arch/ioport.h>
+#include <arch/lapic.h>
+#include <arch/ioapic.h>
 
 /*
  * i8259A definitions 
@@ -43,22 +47,119 @@
 #define SLAVE(mask) (((mask)>>8) & 0xff)
 
 /*
- * External IRQs range from 32-47
+ * IMCR (interrupt mode configuration register) ports and values
+ */
+#define IMCR_SELECT_PORT 0x22
+#define IMCR_DATA_PORT   0x23
+#define IMCR_SELECT      0x70
+#define IMCR_APIC_MODE   0x01
+
+/*
+ * External IRQs range from 32-55.
+ * IRQs 0-15 are the ISA IRQs; with the PICs, only those exist.
+ * With an IO APIC, IRQs 16-23 are its pins 16-23 (PCI interrupts).
  */
 #define FIRST_IRQ 32
-#define NUM_IRQS 16
+#define NUM_IRQS 24
+#define NUM_PIC_IRQS 16
 #define VALID_IRQ(irq) ((irq) >= 0 && (irq) < NUM_IRQS)
 
+/*
+ * MP table polarity and trigger flags of an interrupt assignment
+ */
+#define MP_POLARITY_MASK   0x3
+#define MP_POLARITY_LOW    0x3
+#define MP_POLARITY_HIGH   0x1
+#define MP_TRIGGER_MASK    0xC
+#define MP_TRIGGER_LEVEL   0xC
+#define MP_TRIGGER_EDGE    0x4
+
 /*
  * Current IRQ mask.
  */
 static irq_mask_t s_irqmask;
 
 /*
- * Initialize i8259A interrupt controllers.
+ * True if the IO APIC is used rather than the PICs,
+ * and the IO APIC pin and mode of each IRQ (pin -1 if none).
+ */
+static bool s_use_ioapic;
+static int s_irq_pin[NUM_IRQS];
+static u32_t s_irq_mode[NUM_IRQS];
+
+/*
+ * Convert MP table polarity and trigger flags to an
+ * IO APIC input mode, given the defaults for the bus.
+ */
+static u32_t irq_mp_flags_to_mode(u16_t flags, u32_t bus_default)
+{
+	u32_t mode = bus_default;
+
+	if ((flags & MP_POLARITY_MASK) == MP_POLARITY_LOW) {
+		mode |= IOAPIC_ACTIVE_LOW;
+	} else if ((flags & MP_POLARITY_MASK) == MP_POLARITY_HIGH) {
+		mode &= ~IOAPIC_ACTIVE_LOW;
+	}
+	if ((flags & MP_TRIGGER_MASK) == MP_TRIGGER_LEVEL) {
+		mode |= IOAPIC_LEVEL;
+	} else if ((flags & MP_TRIGGER_MASK) == MP_TRIGGER_EDGE) {
+		mode &= ~IOAPIC_LEVEL;
+	}
+	return mode;
+}
+
+/*
+ * Switch from the PICs to the IO APIC.
+ * All IRQs are routed to the bootstrap processor, and masked.
+ */
+static void irq_init_ioapic(ulong_t ioapic_addr)
+{
+	int irq, pin;
+	u16_t flags;
+	u32_t pins_used = 0;
+
+	/* mask all PIC inputs, and disconnect the PICs if necessary */
+	ioport_outb(0xA1, 0xFF);
+	ioport_outb(0x21, 0xFF);
+	if (smp_has_imcr()) {
+		ioport_outb(IMCR_SELECT_PORT, IMCR_SELECT);
+		ioport_outb(IMCR_DATA_PORT, IMCR_APIC_MODE);
+	}
+
+	ioapic_init(ioapic_addr);
+
+	for (irq = 0; irq < NUM_IRQS; irq++) {
+		if (irq < NUM_PIC_IRQS) {
+			/* ISA interrupts are active high and edge triggered by default */
+			pin = smp_get_isa_irq_pin(irq, &flags);
+			s_irq_mode[irq] = irq_mp_flags_to_mode(flags, 0);
+		} else {
+			/* PCI interrupts are active low and level triggered */
+			pin = irq;
+			s_irq_mode[irq] = IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL;
+		}
+		if (pin < 0 || pin >= ioapic_num_pins() || (pins_used & (1UL << pin))) {
+			s_irq_pin[irq] = -1;
+			continue;
+		}
+		pins_used |= 1UL << pin;
+		s_irq_pin[irq] = pin;
+		ioapic_route(pin, FIRST_IRQ + irq, s_irq_mode[irq], g_cpus[0].arch_id);
+	}
+
+	s_irqmask = 0xffffffff;
+	s_use_ioapic = true;
+}
+
+/*
+ * Initialize the interrupt controllers: the IO APIC if there
+ * is one (and a local APIC to receive its interrupts),
+ * otherwise the i8259A pair.
  */
 void irq_init(void)
 {
+	ulong_t ioapic_addr = smp_get_ioapic_addr();
+
 	ioport_outb(0x20, ICW1);        /* ICW1 to master */
 	ioport_outb(0xA0, ICW1);        /* ICW1 to slave */
 	ioport_outb(0x21, ICW2_MASTER); /* ICW2 to master */
@@ -70,7 +171,11 @@ void irq_init(void)
 	ioport_outb(0xA1, 0xFF);        /* mask all ints in slave; OCW1 to slave */
 	ioport_outb(0x21, 0xFB);        /* mask all ints but 2 in master; OCW1 to master */
 
-	s_irqmask = 0xfffb;
+	s_irqmask = 0xfffffffb;
+
+	if (ioapic_addr != 0 && lapic_present()) {
+		irq_init_ioapic(ioapic_addr);
+	}
 }
 
 void irq_install_handler(int irq, int_handler_t *handler)
@@ -87,6 +192,17 @@ irq_mask_t irq_get_mask(void)
 void irq_set_mask(irq_mask_t mask)
 {
 	u8_t oldmask, newmask;
+	int irq;
+
+	if (s_use_ioapic) {
+		for (irq = 0; irq < NUM_IRQS; irq++) {
+			if (((mask ^ s_irqmask) & (1UL << irq)) && s_irq_pin[irq] >= 0) {
+				ioapic_set_masked(s_irq_pin[irq], (mask & (1UL << irq)) != 0);
+			}
+		}
+		s_irqmask = mask;
+		return;
+	}
 
 	oldmask = MASTER(s_irqmask);
 	newmask = MASTER(mask);
@@ -115,12 +231,33 @@ do { \
 
 void irq_enable(int irq)
 {
-	MODIFY_IRQ_MASK(irq, &= ~(1 << irq));
+	MODIFY_IRQ_MASK(irq, &= ~(1UL << irq));
 }
 
 void irq_disable(int irq)
 {
-	MODIFY_IRQ_MASK(irq, |= (1 << irq));
+	MODIFY_IRQ_MASK(irq, |= (1UL << irq));
+}
+
+/*
+ * Deliver given IRQ to given CPU.
+ * With the PICs, all IRQs go to the bootstrap processor,
+ * so this has no effect.
+ */
+void irq_set_cpu(int irq, int cpu_id)
+{
+	bool iflag;
+
+	KASSERT(VALID_IRQ(irq));
+	KASSERT(cpu_id >= 0 && cpu_id < CPU_MAX);
+
+	if (!s_use_ioapic || s_irq_pin[irq] < 0) {
+		return;
+	}
+
+	iflag = int_begin_atomic();
+	ioapic_route(s_irq_pin[irq], FIRST_IRQ + irq, s_irq_mode[irq], g_cpus[cpu_id].arch_id);
+	int_end_atomic(iflag);
 }
 
 void irq_begin(struct thread_context *context)
@@ -135,7 +272,10 @@ void irq_end(struct thread_context *context)
 
 	KASSERT(VALID_IRQ(irq));
 
-	if (irq < 8) {
+	if (s_use_ioapic) {
+		/* a single memory-mapped write */
+		lapic_eoi();
+	} else if (irq < 8) {
 		/* Specific EOI to master PIC */
 		ioport_outb(0x20, command);
 	} else {
@@ -0,0 +1,209 @@
+/*
+ * GeekOS - x86 local APIC
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/cons.h>
+#include <arch/vm.h>
+#include <arch/lapic.h>
+
+/*
+ * Local APIC register offsets.
+ */
+#define LAPIC_ID      0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_TPR     0x080   /* task priority */
+#define LAPIC_EOI     0x0B0
+#define LAPIC_SVR     0x0F0   /* spurious interrupt vector */
+#define LAPIC_ICR_LO  0x300   /* interrupt command */
+#define LAPIC_ICR_HI  0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_ERR 0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+/* bits in the spurious interrupt vector register */
+#define LAPIC_SVR_ENABLE (1 << 8)
+
+/* bits in the interrupt command register */
+#define LAPIC_ICR_INIT         (5 << 8)
+#define LAPIC_ICR_STARTUP      (6 << 8)
+#define LAPIC_ICR_PENDING      (1 << 12)
+#define LAPIC_ICR_ASSERT       (1 << 14)
+#define LAPIC_ICR_LEVEL        (1 << 15)
+#define LAPIC_ICR_ALL_BUT_SELF (3 << 18)
+
+/* bits in local vector table entries */
+#define LAPIC_LVT_MASKED         (1 << 16)
+#define LAPIC_LVT_TIMER_PERIODIC (1 << 17)
+
+/* divide the bus clock by 16 for the timer */
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+/* virtual address of the local APIC registers, 0 if there is no local APIC */
+static volatile u8_t *s_lapic;
+
+static __inline__ u32_t lapic_read(ulong_t reg)
+{
+	return *((volatile u32_t *) (s_lapic + reg));
+}
+
+static __inline__ void lapic_write(ulong_t reg, u32_t value)
+{
+	*((volatile u32_t *) (s_lapic + reg)) = value;
+}
+
+/*
+ * Send an interrupt command, and wait until it has been accepted.
+ */
+static void lapic_send_icr(int apic_id, u32_t command)
+{
+	bool iflag = int_begin_atomic();
+
+	lapic_write(LAPIC_ICR_HI, ((u32_t) apic_id) << 24);
+	lapic_write(LAPIC_ICR_LO, command);
+	while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING) {
+		/* wait */
+	}
+
+	int_end_atomic(iflag);
+}
+
+static void lapic_spurious_int_handler(struct thread_context *context)
+{
+	/* spurious interrupts must not be acknowledged */
+}
+
+/*
+ * Enable the calling CPU's local APIC.
+ */
+static void lapic_enable(void)
+{
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_LVT_ERR, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * Map the local APIC registers at given physical address,
+ * and enable the local APIC of the bootstrap processor.
+ */
+void lapic_init(ulong_t paddr)
+{
+	x86_vm_map_io(paddr);
+	s_lapic = (volatile u8_t *) paddr;
+	int_install_handler(LAPIC_SPURIOUS_VECTOR, &lapic_spurious_int_handler);
+	lapic_enable();
+	cons_printf("Local APIC version %lx, id %d\n", lapic_read(LAPIC_VERSION) & 0xFF, lapic_get_id());
+}
+
+/*
+ * Enable the local APIC of an application processor.
+ */
+void lapic_init_ap(void)
+{
+	KASSERT(s_lapic != 0);
+	lapic_enable();
+}
+
+bool lapic_present(void)
+{
+	return s_lapic != 0;
+}
+
+/*
+ * Get the id of the calling CPU's local APIC.
+ */
+int lapic_get_id(void)
+{
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+/*
+ * Signal end of interrupt.
+ */
+void lapic_eoi(void)
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/*
+ * Send an interrupt with given vector to the CPU with given local APIC id.
+ */
+void lapic_send_ipi(int apic_id, int vector)
+{
+	lapic_send_icr(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+/*
+ * Send an interrupt with given vector to all CPUs but the calling CPU.
+ */
+void lapic_send_ipi_others(int vector)
+{
+	lapic_send_icr(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | vector);
+}
+
+/*
+ * Send an INIT IPI to given CPU, resetting it.
+ */
+void lapic_send_init(int apic_id)
+{
+	lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+	lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+}
+
+/*
+ * Send a STARTUP IPI to given CPU, starting it in real mode
+ * at given physical address (which must be page-aligned and below 1M).
+ */
+void lapic_send_startup(int apic_id, ulong_t start_paddr)
+{
+	KASSERT((start_paddr & 0xFFF00FFF) == 0);
+	lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | (start_paddr >> 12));
+}
+
+/*
+ * Start the calling CPU's local APIC timer, interrupting at
+ * LAPIC_TIMER_VECTOR after given count (and every count,
+ * if periodic).  The count is in units of 16 bus clocks.
+ */
+void lapic_timer_start(u32_t count, bool periodic)
+{
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | (periodic ? LAPIC_LVT_TIMER_PERIODIC : 0));
+	lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+/*
+ * Stop the calling CPU's local APIC timer.
+ */
+void lapic_timer_stop(void)
+{
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+/*
+ * Read the current count of the calling CPU's local APIC timer.
+ */
+u32_t lapic_timer_read(void)
+{
+	return lapic_read(LAPIC_TIMER_CURRENT);
+}
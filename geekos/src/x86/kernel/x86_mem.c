@@ -21,6 +21,7 @@
 #include <geekos/string.h>
 #include <geekos/kassert.h>
 #include <geekos/mem.h>
+#include <geekos/smp.h>
 #include <arch/cpu.h>
 
 /* symbol defined by the linker specifying the kernel code+data end address */
@@ -77,14 +78,18 @@ void mem_scan_regions(struct multiboot_info *boot_record,
 
 	/* preserve the BIOS data area */
 	addr = scan_reg_func(addr, PAGE_SIZE, FRAME_UNUSED, data);
+	/* startup code for application processors (see x86_smp.c) */
+	addr = scan_reg_func(addr, SMP_TRAMPOLINE_ADDR + PAGE_SIZE, FRAME_KERN, data);
 	/* available low memory */
-	addr = scan_reg_func(addr, ISA_HOLE_START, FRAME_AVAIL, data);
+	addr = scan_reg_func(addr, ISA_HOLE_START - PAGE_SIZE, FRAME_AVAIL, data);
+	/* extended BIOS data area (may contain the MP configuration table) */
+	addr = scan_reg_func(addr, ISA_HOLE_START, FRAME_HW, data);
 	/* ISA hole */
 	addr = scan_reg_func(addr, ISA_HOLE_END, FRAME_HW, data);
 	/* initial kernel stack */
 	addr = scan_reg_func(addr, ISA_HOLE_END+PAGE_SIZE, FRAME_KSTACK, data);
 	/* kernel code/data and framelist structure */
-	addr = scan_reg_func(addr, layout.kernel_end + layout.framelist_numframes, FRAME_KERN, data);
+	addr = scan_reg_func(addr, layout.kernel_end + layout.framelist_numframes * PAGE_SIZE, FRAME_KERN, data);
 	/* available high memory */
 	addr = scan_reg_func(addr, layout.numframes * PAGE_SIZE, FRAME_AVAIL, data);
 }
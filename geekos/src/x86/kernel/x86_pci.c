@@ -0,0 +1,97 @@
+/*
+ * GeekOS - PCI configuration space access
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/int.h>
+#include <arch/ioport.h>
+#include <arch/pci.h>
+
+/*
+ * Configuration space is accessed using configuration mechanism #1:
+ * the address of a register is written to the address port,
+ * and the register is then accessed through the data port.
+ */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_MAX_BUS  256
+#define PCI_MAX_DEV  32
+#define PCI_MAX_FUNC 8
+
+static u32_t pci_config_addr(const struct pci_func *pf, unsigned reg)
+{
+	return 0x80000000UL | (pf->bus << 16) | (pf->dev << 11) | (pf->func << 8) | (reg & 0xFC);
+}
+
+/*
+ * Read a 32 bit register from a function's configuration space.
+ */
+u32_t pci_config_read(const struct pci_func *pf, unsigned reg)
+{
+	u32_t value;
+	bool iflag = int_begin_atomic();
+	ioport_outl(PCI_CONFIG_ADDRESS, pci_config_addr(pf, reg));
+	value = ioport_inl(PCI_CONFIG_DATA);
+	int_end_atomic(iflag);
+	return value;
+}
+
+/*
+ * Write a 32 bit register in a function's configuration space.
+ */
+void pci_config_write(const struct pci_func *pf, unsigned reg, u32_t value)
+{
+	bool iflag = int_begin_atomic();
+	ioport_outl(PCI_CONFIG_ADDRESS, pci_config_addr(pf, reg));
+	ioport_outl(PCI_CONFIG_DATA, value);
+	int_end_atomic(iflag);
+}
+
+/*
+ * Find the first PCI function with given class and subclass.
+ * Returns true if one was found, filling in its location.
+ */
+bool pci_find_class(unsigned class_code, unsigned subclass, struct pci_func *pf)
+{
+	u32_t class_reg;
+	unsigned num_funcs;
+
+	for (pf->bus = 0; pf->bus < PCI_MAX_BUS; pf->bus++) {
+		for (pf->dev = 0; pf->dev < PCI_MAX_DEV; pf->dev++) {
+			pf->func = 0;
+			if ((pci_config_read(pf, PCI_REG_ID) & 0xFFFF) == 0xFFFF) {
+				continue; /* no device */
+			}
+
+			/* only multi-function devices have functions other than 0 */
+			num_funcs = (pci_config_read(pf, PCI_REG_HEADER) & (1UL << 23)) ? PCI_MAX_FUNC : 1;
+
+			for (pf->func = 0; pf->func < num_funcs; pf->func++) {
+				if ((pci_config_read(pf, PCI_REG_ID) & 0xFFFF) == 0xFFFF) {
+					continue;
+				}
+				class_reg = pci_config_read(pf, PCI_REG_CLASS);
+				if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xFF) == subclass) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
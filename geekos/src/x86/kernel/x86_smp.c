@@ -0,0 +1,500 @@
+/*
+ * GeekOS - x86 multiprocessor support
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/smp.h>
+#include <geekos/thread.h>
+#include <geekos/timer.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/kassert.h>
+#include <geekos/cons.h>
+#include <arch/cpu.h>
+#include <arch/thread.h>
+#include <arch/lapic.h>
+#include <arch/atomic.h>
+
+/*
+ * NOTES:
+ * - CPUs are found using the Intel MultiProcessor Specification
+ *   configuration table, which the BIOS provides on all PCs
+ *   with more than one CPU (and which QEMU and Bochs provide).
+ * - Application processors are started one at a time, using
+ *   the INIT-SIPI-SIPI sequence.
+ */
+
+/* MP floating pointer structure */
+struct mp_floating_pointer {
+	char signature[4];              /* "_MP_" */
+	u32_t config_addr;              /* physical address of configuration table */
+	u8_t length;                    /* in 16 byte units */
+	u8_t spec_rev;
+	u8_t checksum;
+	u8_t features[5];               /* features[0] nonzero means default configuration */
+} __attribute__((packed));
+
+/* MP configuration table header */
+struct mp_config_header {
+	char signature[4];              /* "PCMP" */
+	u16_t length;
+	u8_t spec_rev;
+	u8_t checksum;
+	char oem_id[8];
+	char product_id[12];
+	u32_t oem_table_addr;
+	u16_t oem_table_size;
+	u16_t entry_count;
+	u32_t lapic_addr;               /* physical address of local APICs */
+	u16_t ext_length;
+	u8_t ext_checksum;
+	u8_t reserved;
+} __attribute__((packed));
+
+/* MP configuration table processor entry */
+struct mp_processor_entry {
+	u8_t type;
+	u8_t lapic_id;
+	u8_t lapic_version;
+	u8_t flags;
+	u32_t signature;
+	u32_t features;
+	u32_t reserved[2];
+} __attribute__((packed));
+
+/* MP configuration table bus entry */
+struct mp_bus_entry {
+	u8_t type;
+	u8_t bus_id;
+	char bus_type[6];               /* e.g., "ISA   " or "PCI   " */
+} __attribute__((packed));
+
+/* MP configuration table IO APIC entry */
+struct mp_ioapic_entry {
+	u8_t type;
+	u8_t ioapic_id;
+	u8_t ioapic_version;
+	u8_t flags;
+	u32_t ioapic_addr;              /* physical address of IO APIC registers */
+} __attribute__((packed));
+
+/* MP configuration table IO interrupt assignment entry */
+struct mp_ioint_entry {
+	u8_t type;
+	u8_t int_type;
+	u16_t flags;                    /* polarity and trigger mode */
+	u8_t src_bus_id;
+	u8_t src_bus_irq;
+	u8_t dst_ioapic_id;
+	u8_t dst_ioapic_pin;
+} __attribute__((packed));
+
+/* MP configuration table entry types and their sizes */
+#define MP_ENTRY_PROCESSOR      0
+#define MP_ENTRY_BUS            1
+#define MP_ENTRY_IOAPIC         2
+#define MP_ENTRY_IOINT          3
+#define MP_ENTRY_PROCESSOR_SIZE 20
+#define MP_ENTRY_OTHER_SIZE     8
+
+/* processor entry flags */
+#define MP_PROC_ENABLED (1 << 0)
+#define MP_PROC_BSP     (1 << 1)
+
+/* IO APIC entry flags */
+#define MP_IOAPIC_ENABLED (1 << 0)
+
+/* IO interrupt entry type for vectored interrupts */
+#define MP_IOINT_INT 0
+
+/* floating pointer feature bit: IMCR present (PIC mode must be switched off) */
+#define MP_FEATURE2_IMCR 0x80
+
+/* number of ISA IRQs */
+#define MP_NUM_ISA_IRQS 16
+
+/* where to look for the MP floating pointer structure */
+#define MP_SEARCH_EBDA_START 0x9FC00UL
+#define MP_SEARCH_EBDA_END   0xA0000UL
+#define MP_SEARCH_BIOS_START 0xF0000UL
+#define MP_SEARCH_BIOS_END   0x100000UL
+
+/* how long to wait for an application processor to start */
+#define SMP_INIT_DELAY_NS    TIMER_MS_TO_NS(10)
+#define SMP_STARTUP_DELAY_NS 200000UL
+#define SMP_ONLINE_TIMEOUT_NS TIMER_MS_TO_NS(100)
+
+/*
+ * Parameter block at the end of the trampoline
+ * (must keep in sync with x86_smp_asm.S).
+ */
+struct trampoline_params {
+	u16_t padding;
+	u16_t gdtr[3];
+	u32_t cr0, cr3, cr4;
+	u32_t stack;
+	u32_t entry;
+};
+
+extern char smp_trampoline_start, smp_trampoline_params, smp_trampoline_end;
+
+/* number of CPUs found, including the bootstrap processor */
+static int s_num_cpus_present = 1;
+
+/* IO APIC found in the configuration table, if any */
+static ulong_t s_ioapic_addr;
+static int s_ioapic_id = -1;
+static bool s_imcr_present;
+
+/* IO APIC pins and flags of the ISA IRQs (-1 if not connected) */
+static int s_isa_irq_pin[MP_NUM_ISA_IRQS];
+static u16_t s_isa_irq_flags[MP_NUM_ISA_IRQS];
+
+/* application processor currently being started */
+static struct cpu *volatile s_starting_cpu;
+
+/*
+ * Compute the byte sum of given memory region;
+ * MP structures sum to 0.
+ */
+static u8_t smp_checksum(const void *addr, ulong_t len)
+{
+	const u8_t *p = addr;
+	u8_t sum = 0;
+
+	while (len-- > 0) {
+		sum += *p++;
+	}
+	return sum;
+}
+
+/*
+ * Search given physical memory region for the MP floating pointer.
+ */
+static struct mp_floating_pointer *smp_find_floating_pointer(ulong_t start, ulong_t end)
+{
+	ulong_t addr;
+	struct mp_floating_pointer *mpfp;
+
+	for (addr = start; addr + sizeof(struct mp_floating_pointer) <= end; addr += 16) {
+		mpfp = (struct mp_floating_pointer *) addr;
+		if (strncmp(mpfp->signature, "_MP_", 4) == 0
+		    && smp_checksum(mpfp, mpfp->length * 16) == 0) {
+			return mpfp;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the MP configuration table.
+ * Returns 0 if there isn't one.
+ */
+static struct mp_config_header *smp_find_config(void)
+{
+	struct mp_floating_pointer *mpfp;
+	struct mp_config_header *config;
+
+	mpfp = smp_find_floating_pointer(MP_SEARCH_EBDA_START, MP_SEARCH_EBDA_END);
+	if (mpfp == 0) {
+		mpfp = smp_find_floating_pointer(MP_SEARCH_BIOS_START, MP_SEARCH_BIOS_END);
+	}
+	if (mpfp == 0 || mpfp->config_addr == 0 || mpfp->features[0] != 0) {
+		/* no table, or one of the default configurations: treat as a uniprocessor */
+		return 0;
+	}
+	s_imcr_present = (mpfp->features[1] & MP_FEATURE2_IMCR) != 0;
+
+	config = (struct mp_config_header *) mpfp->config_addr;
+	if (strncmp(config->signature, "PCMP", 4) != 0 || smp_checksum(config, config->length) != 0) {
+		cons_printf("Invalid MP configuration table\n");
+		return 0;
+	}
+	return config;
+}
+
+/*
+ * Record a processor entry.
+ * The bootstrap processor is always CPU 0.
+ */
+static void smp_parse_processor(struct mp_processor_entry *proc)
+{
+	if (!(proc->flags & MP_PROC_ENABLED) || (proc->flags & MP_PROC_BSP)) {
+		return;
+	}
+	if (s_num_cpus_present == CPU_MAX) {
+		cons_printf("Ignoring CPU with local APIC id %d\n", proc->lapic_id);
+		return;
+	}
+	g_cpus[s_num_cpus_present++].arch_id = proc->lapic_id;
+}
+
+/*
+ * Record an IO interrupt assignment entry, if it connects
+ * an ISA IRQ to the (first) IO APIC.
+ */
+static void smp_parse_ioint(struct mp_ioint_entry *ioint, int isa_bus_id)
+{
+	if (ioint->int_type != MP_IOINT_INT || ioint->src_bus_id != isa_bus_id
+	    || ioint->dst_ioapic_id != s_ioapic_id || ioint->src_bus_irq >= MP_NUM_ISA_IRQS) {
+		return;
+	}
+	s_isa_irq_pin[ioint->src_bus_irq] = ioint->dst_ioapic_pin;
+	s_isa_irq_flags[ioint->src_bus_irq] = ioint->flags;
+}
+
+/*
+ * Record the CPUs, IO APIC and ISA interrupt assignments
+ * listed in the MP configuration table.
+ * (Entries are sorted by type, so bus entries come
+ * before the interrupt assignments that refer to them.)
+ */
+static void smp_parse_config(struct mp_config_header *config)
+{
+	u8_t *entry = (u8_t *) (config + 1);
+	struct mp_bus_entry *bus;
+	struct mp_ioapic_entry *ioapic;
+	int isa_bus_id = -1;
+	int i;
+
+	for (i = 0; i < MP_NUM_ISA_IRQS; i++) {
+		/* ISA IRQs without an assignment entry are not connected */
+		s_isa_irq_pin[i] = -1;
+	}
+
+	for (i = 0; i < config->entry_count; i++) {
+		switch (*entry) {
+		case MP_ENTRY_PROCESSOR:
+			smp_parse_processor((struct mp_processor_entry *) entry);
+			entry += MP_ENTRY_PROCESSOR_SIZE;
+			continue;
+
+		case MP_ENTRY_BUS:
+			bus = (struct mp_bus_entry *) entry;
+			if (strncmp(bus->bus_type, "ISA", 3) == 0) {
+				isa_bus_id = bus->bus_id;
+			}
+			break;
+
+		case MP_ENTRY_IOAPIC:
+			ioapic = (struct mp_ioapic_entry *) entry;
+			if ((ioapic->flags & MP_IOAPIC_ENABLED) && s_ioapic_addr == 0) {
+				s_ioapic_addr = ioapic->ioapic_addr;
+				s_ioapic_id = ioapic->ioapic_id;
+			}
+			break;
+
+		case MP_ENTRY_IOINT:
+			smp_parse_ioint((struct mp_ioint_entry *) entry, isa_bus_id);
+			break;
+		}
+		entry += MP_ENTRY_OTHER_SIZE;
+	}
+}
+
+/*
+ * Busy-wait for given number of nanoseconds.
+ */
+static void smp_delay(u64_t ns)
+{
+	u64_t start = timer_get_ns();
+
+	while (timer_get_ns() - start < ns) {
+		cpu_relax();
+	}
+}
+
+/*
+ * Entry point of application processors, called from the trampoline
+ * with interrupts disabled.
+ */
+static void smp_ap_main(void)
+{
+	struct cpu *cpu = s_starting_cpu;
+
+	x86_seg_load_gdt_ap(cpu->id);
+	int_load_idt();
+	lapic_init_ap();
+	timer_init_ap();
+
+	/* start scheduling: this doesn't return */
+	thread_start_cpu();
+}
+
+/*
+ * Start given application processor, and wait for it to come online.
+ */
+static bool smp_start_cpu(struct cpu *cpu)
+{
+	struct trampoline_params *params;
+	struct thread *idle;
+	u64_t start;
+
+	idle = thread_create_idle(cpu);
+
+	params = (struct trampoline_params *)
+		(SMP_TRAMPOLINE_ADDR + (&smp_trampoline_params - &smp_trampoline_start));
+	x86_seg_get_gdtr(params->gdtr);
+	params->cr0 = x86_get_cr0();
+	params->cr3 = x86_get_cr3();
+	params->cr4 = x86_get_cr4();
+	params->stack = (u32_t) (((u8_t *) idle->stack) + THREAD_STACK_SIZE);
+	params->entry = (u32_t) &smp_ap_main;
+	s_starting_cpu = cpu;
+
+	/* INIT-SIPI-SIPI */
+	lapic_send_init(cpu->arch_id);
+	smp_delay(SMP_INIT_DELAY_NS);
+	lapic_send_startup(cpu->arch_id, SMP_TRAMPOLINE_ADDR);
+	smp_delay(SMP_STARTUP_DELAY_NS);
+	if (!cpu->online) {
+		lapic_send_startup(cpu->arch_id, SMP_TRAMPOLINE_ADDR);
+	}
+
+	start = timer_get_ns();
+	while (!cpu->online && timer_get_ns() - start < SMP_ONLINE_TIMEOUT_NS) {
+		cpu_relax();
+	}
+	return cpu->online;
+}
+
+static void smp_reschedule_int_handler(struct thread_context *context)
+{
+	/* the sender has already set need_reschedule for this CPU */
+	lapic_eoi();
+}
+
+/*
+ * Find the CPUs, and enable the local APIC of the bootstrap processor.
+ * Must be called before irq_init() and timer_init().
+ */
+void smp_init(void)
+{
+	struct x86_cpuid_info cpuid_info;
+	struct mp_config_header *config;
+
+	if (!x86_cpuid(&cpuid_info) || !cpuid_info.feature_info_edx.apic) {
+		return;
+	}
+	config = smp_find_config();
+	if (config == 0) {
+		return;
+	}
+
+	lapic_init(config->lapic_addr);
+	g_cpus[0].arch_id = lapic_get_id();
+	smp_parse_config(config);
+
+	int_install_handler(SMP_RESCHEDULE_VECTOR, &smp_reschedule_int_handler);
+
+	cons_printf("Found %d CPUs\n", s_num_cpus_present);
+}
+
+/*
+ * Start the application processors.
+ * Must be called after timer_init(), with interrupts enabled.
+ */
+void smp_start_cpus(void)
+{
+	int i;
+
+	KASSERT(int_enabled());
+
+	if (s_num_cpus_present == 1) {
+		return;
+	}
+
+	/* from now on, more than one CPU may be in the kernel */
+	memcpy((void *) SMP_TRAMPOLINE_ADDR, &smp_trampoline_start,
+		&smp_trampoline_end - &smp_trampoline_start);
+	smp_activate_kernel_lock();
+
+	for (i = 1; i < s_num_cpus_present; i++) {
+		if (!smp_start_cpu(&g_cpus[i])) {
+			cons_printf("CPU %d (local APIC id %d) did not start\n", i, g_cpus[i].arch_id);
+		}
+	}
+	cons_printf("%d CPUs online\n", g_num_cpus);
+}
+
+/*
+ * Get the number of CPUs found by smp_init().
+ */
+int smp_num_cpus_present(void)
+{
+	return s_num_cpus_present;
+}
+
+/*
+ * Get the physical address of the IO APIC registers,
+ * or 0 if no IO APIC was found.
+ */
+ulong_t smp_get_ioapic_addr(void)
+{
+	return s_ioapic_addr;
+}
+
+/*
+ * Get the IO APIC pin that given ISA IRQ is connected to
+ * (-1 if none), and its MP table polarity/trigger flags.
+ */
+int smp_get_isa_irq_pin(int irq, u16_t *flags)
+{
+	KASSERT(irq >= 0 && irq < MP_NUM_ISA_IRQS);
+	*flags = s_isa_irq_flags[irq];
+	return s_isa_irq_pin[irq];
+}
+
+/*
+ * Return true if the interrupt mode configuration register
+ * must be used to route interrupts away from the PICs.
+ */
+bool smp_has_imcr(void)
+{
+	return s_imcr_present;
+}
+
+/*
+ * Make given CPU check its need_reschedule flag.
+ */
+void smp_send_reschedule(struct cpu *cpu)
+{
+	lapic_send_ipi(cpu->arch_id, SMP_RESCHEDULE_VECTOR);
+}
+
+/*
+ * Acquire the kernel lock on entry to an interrupt handler,
+ * unless the interrupted code already held it
+ * (i.e., had interrupts disabled).
+ */
+void smp_int_enter(struct thread_context *context)
+{
+	if (context->eflags & EFLAGS_IF) {
+		smp_lock_kernel();
+	}
+}
+
+/*
+ * Release the kernel lock before returning to code
+ * that had interrupts enabled.
+ */
+void smp_int_exit(struct thread_context *context)
+{
+	if (context->eflags & EFLAGS_IF) {
+		smp_unlock_kernel();
+	}
+}
@@ -0,0 +1,244 @@
+/*
+ * GeekOS - x86 string functions
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/string.h>
+#include <geekos/types.h>
+#include <geekos/int.h>
+#include <geekos/cons.h>
+#include <arch/cpu.h>
+#include <arch/string.h>
+
+/*
+ * NOTES:
+ * - Copies and fills are done a 32 bit word at a time using
+ *   rep movsl/stosl, with byte moves for the unaligned head and tail.
+ * - If the CPU supports SSE2, large copies and fills move 64 bytes
+ *   per iteration through xmm0-xmm3.  The kernel does not save
+ *   FPU/SSE state on context switches, so the xmm registers are
+ *   only used with interrupts disabled: no other thread or
+ *   interrupt handler can observe or clobber them.  Large requests
+ *   are split into chunks so that interrupts aren't held off for long.
+ * - Each CPU has its own xmm registers, so only the local CPU's
+ *   interrupts are disabled; unlike int_begin_atomic(), this doesn't
+ *   take the kernel lock, and copies on several CPUs run in parallel.
+ */
+
+/* requests at least this large use SSE2 (if available) */
+#define X86_SSE2_THRESHOLD   512
+
+/* bytes moved per interrupts-disabled SSE2 chunk */
+#define X86_SSE2_CHUNK_SIZE  4096
+
+/* requests smaller than this are just done a byte at a time */
+#define X86_WORD_THRESHOLD   16
+
+/*
+ * memset() is used to clear the bss, so this flag must not be in the bss:
+ * until it is cleared, the flag could hold garbage.
+ */
+static bool s_use_sse2 __attribute__((section(".data"))) = false;
+
+/*
+ * Enable SSE, if the CPU supports SSE2.
+ * Called once CPUID information is available.
+ */
+void x86_string_init(struct x86_cpuid_info *cpuid_info)
+{
+	if (!cpuid_info->feature_info_edx.fxsr || !cpuid_info->feature_info_edx.sse2) {
+		return;
+	}
+
+	/* no x87 emulation; SSE instructions and exceptions enabled */
+	x86_set_cr0((x86_get_cr0() & ~CR0_EM) | CR0_MP);
+	x86_set_cr4(x86_get_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	__asm__ __volatile__ ("fninit");
+
+	s_use_sse2 = true;
+	cons_printf("CPU supports SSE2\n");
+}
+
+/*
+ * Begin a region using the xmm registers, by disabling
+ * interrupts on the calling CPU (only).
+ * Returns true if interrupts were enabled.
+ */
+static __inline__ bool x86_sse2_begin(void)
+{
+	bool iflag = int_enabled();
+	if (iflag)
+		int_disable__();
+	return iflag;
+}
+
+/*
+ * End a region begun by x86_sse2_begin().
+ */
+static __inline__ void x86_sse2_end(bool iflag)
+{
+	if (iflag)
+		int_enable__();
+}
+
+static __inline__ void x86_movsb(u8_t **d, const u8_t **s, size_t n)
+{
+	__asm__ __volatile__ ("rep movsb" : "+D" (*d), "+S" (*s), "+c" (n) : : "memory");
+}
+
+static __inline__ void x86_stosb(u8_t **d, u8_t c, size_t n)
+{
+	__asm__ __volatile__ ("rep stosb" : "+D" (*d), "+c" (n) : "a" (c) : "memory");
+}
+
+/*
+ * Copy 64 byte blocks to a 16 byte aligned destination.
+ */
+static void x86_sse2_copy(u8_t **d, const u8_t **s, size_t num_blocks)
+{
+	bool iflag;
+	size_t n;
+
+	while (num_blocks > 0) {
+		n = num_blocks;
+		if (n > X86_SSE2_CHUNK_SIZE / 64) {
+			n = X86_SSE2_CHUNK_SIZE / 64;
+		}
+		num_blocks -= n;
+
+		iflag = x86_sse2_begin();
+		__asm__ __volatile__ (
+			"1:\n\t"
+			"movdqu (%1), %%xmm0\n\t"
+			"movdqu 16(%1), %%xmm1\n\t"
+			"movdqu 32(%1), %%xmm2\n\t"
+			"movdqu 48(%1), %%xmm3\n\t"
+			"movdqa %%xmm0, (%0)\n\t"
+			"movdqa %%xmm1, 16(%0)\n\t"
+			"movdqa %%xmm2, 32(%0)\n\t"
+			"movdqa %%xmm3, 48(%0)\n\t"
+			"addl $64, %1\n\t"
+			"addl $64, %0\n\t"
+			"decl %2\n\t"
+			"jnz 1b"
+			: "+r" (*d), "+r" (*s), "+r" (n)
+			:
+			: "memory", "cc");
+		x86_sse2_end(iflag);
+	}
+}
+
+/*
+ * Fill 64 byte blocks at a 16 byte aligned destination
+ * with given 32 bit pattern.
+ */
+static void x86_sse2_fill(u8_t **d, u32_t pattern, size_t num_blocks)
+{
+	bool iflag;
+	size_t n;
+
+	while (num_blocks > 0) {
+		n = num_blocks;
+		if (n > X86_SSE2_CHUNK_SIZE / 64) {
+			n = X86_SSE2_CHUNK_SIZE / 64;
+		}
+		num_blocks -= n;
+
+		iflag = x86_sse2_begin();
+		__asm__ __volatile__ (
+			"movd %2, %%xmm0\n\t"
+			"pshufd $0, %%xmm0, %%xmm0\n\t"
+			"1:\n\t"
+			"movdqa %%xmm0, (%0)\n\t"
+			"movdqa %%xmm0, 16(%0)\n\t"
+			"movdqa %%xmm0, 32(%0)\n\t"
+			"movdqa %%xmm0, 48(%0)\n\t"
+			"addl $64, %0\n\t"
+			"decl %1\n\t"
+			"jnz 1b"
+			: "+r" (*d), "+r" (n)
+			: "r" (pattern)
+			: "memory", "cc");
+		x86_sse2_end(iflag);
+	}
+}
+
+void memcpy(void *dst, const void *src, size_t n)
+{
+	u8_t *d = dst;
+	const u8_t *s = src;
+	size_t head, num_words;
+
+	if (n < X86_WORD_THRESHOLD) {
+		x86_movsb(&d, &s, n);
+		return;
+	}
+
+	if (s_use_sse2 && n >= X86_SSE2_THRESHOLD) {
+		/* align the destination to 16 bytes, then copy 64 byte blocks */
+		head = (16 - ((ulong_t) d & 15)) & 15;
+		x86_movsb(&d, &s, head);
+		n -= head;
+		x86_sse2_copy(&d, &s, n / 64);
+		n &= 63;
+	}
+
+	/* align the destination to 4 bytes, then copy words */
+	head = (4 - ((ulong_t) d & 3)) & 3;
+	if (head > n) {
+		head = n;
+	}
+	x86_movsb(&d, &s, head);
+	n -= head;
+
+	num_words = n / 4;
+	__asm__ __volatile__ ("rep movsl" : "+D" (d), "+S" (s), "+c" (num_words) : : "memory");
+
+	x86_movsb(&d, &s, n & 3);
+}
+
+void memset(void *buf, int c, size_t n)
+{
+	u8_t *d = buf;
+	u32_t pattern = (c & 0xFF) * 0x01010101UL;
+	size_t head, num_words;
+
+	if (n < X86_WORD_THRESHOLD) {
+		x86_stosb(&d, c, n);
+		return;
+	}
+
+	if (s_use_sse2 && n >= X86_SSE2_THRESHOLD) {
+		head = (16 - ((ulong_t) d & 15)) & 15;
+		x86_stosb(&d, c, head);
+		n -= head;
+		x86_sse2_fill(&d, pattern, n / 64);
+		n &= 63;
+	}
+
+	head = (4 - ((ulong_t) d & 3)) & 3;
+	if (head > n) {
+		head = n;
+	}
+	x86_stosb(&d, c, head);
+	n -= head;
+
+	num_words = n / 4;
+	__asm__ __volatile__ ("rep stosl" : "+D" (d), "+c" (num_words) : "a" (pattern) : "memory");
+
+	x86_stosb(&d, c, n & 3);
+}
@@ -20,29 +20,388 @@
 
 #include <geekos/timer.h>
 #include <geekos/irq.h>
+#include <geekos/int.h>
+#include <geekos/thread.h>
+#include <geekos/smp.h>
 #include <geekos/cons.h>
+#include <geekos/kassert.h>
+#include <arch/cpu.h>
+#include <arch/ioport.h>
+#include <arch/lapic.h>
 
 #define TIMER_IRQ 0
 
+/*
+ * 8254 programmable interval timer.
+ * Channel 0 is connected to IRQ 0.
+ */
+#define PIT_FREQ         1193182UL
+#define PIT_CHANNEL0_REG 0x40
+#define PIT_CMD_REG      0x43
+
+/* command: channel 0, access low byte then high byte, mode 2 (rate generator) */
+#define PIT_CMD_CHANNEL0_RATE 0x34
+
+/* command: channel 0, access low byte then high byte, mode 0 (one-shot) */
+#define PIT_CMD_CHANNEL0_ONESHOT 0x30
+
+/* command: read back channel 0's status, then its count (low byte first) */
+#define PIT_CMD_CHANNEL0_READBACK 0xC2
+
+/* read-back status: output is high (one-shot has expired) */
+#define PIT_STATUS_OUT        0x80
+/* read-back status: the count written hasn't been loaded yet */
+#define PIT_STATUS_NULL_COUNT 0x40
+
+/* reload value giving TIMER_HZ interrupts per second */
+#define PIT_DIVISOR ((PIT_FREQ + TIMER_HZ / 2) / TIMER_HZ)
+
+/* longest one-shot interval, limited by the 16 bit counter */
+#define PIT_MAX_ONESHOT_TICKS (0xFFFFUL / PIT_DIVISOR)
+
+/* number of ticks over which the TSC is calibrated */
+#define TSC_CALIBRATE_TICKS TIMER_MS_TO_TICKS(100)
+
+/* number of ticks over which the local APIC timer is calibrated */
+#define LAPIC_CALIBRATE_TICKS TIMER_MS_TO_TICKS(100)
+
+/*
+ * Nanoseconds are computed from cycles as (cycles * s_ns_mult) >> TSC_NS_SHIFT.
+ * The shift is chosen so that the multiplier fits in 32 bits
+ * for any CPU faster than 4 MHz.
+ */
+#define TSC_NS_SHIFT 24
+
+/* true if the TSC can be used for timer_get_ns() */
+static bool s_use_tsc;
+
+/* TSC-to-nanosecond multiplier, and TSC value at calibration time */
+static u32_t s_ns_mult;
+static u64_t s_tsc_base;
+static u64_t s_ns_base;
+
+/* local APIC timer count per tick, or 0 if the PIT is the tick source */
+static u32_t s_lapic_count;
+
+#ifdef TIMER_TICKLESS
+/* set once the PIT has been switched from periodic to one-shot mode */
+static bool s_tickless;
+
+/* number of ticks until the armed one-shot interrupt */
+static u32_t s_oneshot_ticks;
+
+/*
+ * PIT count last loaded, and the number of counts of the current
+ * interval that had already elapsed when it was loaded
+ * (nonzero if timer_rearm() shortened the interval).
+ */
+static u32_t s_oneshot_load;
+static u32_t s_oneshot_skipped;
+
+/*
+ * Start the PIT counting down from given count (at most 0xFFFF)
+ * in one-shot mode.
+ */
+static void timer_load_oneshot(u32_t count)
+{
+	s_oneshot_load = count;
+	ioport_outb(PIT_CMD_REG, PIT_CMD_CHANNEL0_ONESHOT);
+	ioport_outb(PIT_CHANNEL0_REG, count & 0xFF);
+	ioport_outb(PIT_CHANNEL0_REG, (count >> 8) & 0xFF);
+}
+
+/*
+ * Arm the PIT to interrupt once after given number of ticks.
+ */
+static void timer_arm_oneshot(u32_t num_ticks)
+{
+	if (num_ticks > TIMER_TICKLESS_MAX_TICKS) {
+		num_ticks = TIMER_TICKLESS_MAX_TICKS;
+	}
+	if (num_ticks > PIT_MAX_ONESHOT_TICKS) {
+		num_ticks = PIT_MAX_ONESHOT_TICKS;
+	}
+	s_oneshot_ticks = num_ticks;
+	s_oneshot_skipped = 0;
+	timer_load_oneshot(num_ticks * PIT_DIVISOR);
+}
+#endif
+
 static void timer_int_handler(struct thread_context *context)
 {
+#ifdef TIMER_TICKLESS
+	u32_t num_ticks;
+#endif
+
 	irq_begin(context);
-	timer_process_tick();
+#ifdef TIMER_TICKLESS
+	if (s_tickless) {
+		/* events added while processing the ticks are seen below */
+		num_ticks = s_oneshot_ticks;
+		s_oneshot_ticks = 0;
+		timer_process_ticks(num_ticks);
+		timer_arm_oneshot(timer_next_event());
+		irq_end(context);
+		return;
+	}
+#endif
+	timer_process_ticks(1);
 	irq_end(context);
 }
 
-void timer_init(void)
+/*
+ * Local APIC timer interrupt handler: each CPU has its own tick.
+ * The bootstrap processor also advances the global tick count.
+ */
+static void timer_lapic_int_handler(struct thread_context *context)
 {
-	cons_printf("Initialize timer ...............");
+	if (cpu_self()->id == 0) {
+		timer_process_ticks(1);
+	} else {
+		timer_process_cpu_ticks(1);
+	}
+	lapic_eoi();
+}
+
+/*
+ * Divide a 64 bit value by a 32 bit value.
+ * The quotient must fit in 32 bits.
+ */
+static u32_t timer_div64_32(u64_t n, u32_t d)
+{
+	u32_t q, r;
+	__asm__ ("divl %4" : "=a" (q), "=d" (r) : "a" ((u32_t) n), "d" ((u32_t) (n >> 32)), "rm" (d));
+	return q;
+}
+
+/*
+ * Program the PIT to interrupt TIMER_HZ times per second.
+ */
+static void timer_program_pit(void)
+{
+	ioport_outb(PIT_CMD_REG, PIT_CMD_CHANNEL0_RATE);
+	ioport_outb(PIT_CHANNEL0_REG, PIT_DIVISOR & 0xFF);
+	ioport_outb(PIT_CHANNEL0_REG, (PIT_DIVISOR >> 8) & 0xFF);
+}
+
+/*
+ * Switch the timer to tickless mode, if configured.
+ * Returns true if the timer is now tickless.
+ * Interrupts must be disabled.
+ */
+static bool timer_start_tickless(void)
+{
+#ifdef TIMER_TICKLESS
 	/*
-	 * FIXME: for now, just leave the default 18Hz periodic timer.
+	 * Each CPU needs its own tick on a multiprocessor,
+	 * which only the local APIC timers provide.
 	 */
+	if (smp_num_cpus_present() > 1) {
+		return false;
+	}
+	s_tickless = true;
+	timer_arm_oneshot(timer_next_event());
+	cons_printf("Timer is tickless\n");
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Measure the local APIC timer frequency against the PIT,
+ * then make the local APIC timer the tick source in place of the PIT.
+ * Interrupts must be enabled.
+ */
+static void timer_start_lapic(void)
+{
+	u32_t start_tick, elapsed;
+
+	/* start at a tick boundary */
+	start_tick = g_numticks;
+	while (g_numticks == start_tick) {
+		/* wait */
+	}
+	start_tick = g_numticks;
+	lapic_timer_start(0xFFFFFFFFUL, false);
+	while (g_numticks - start_tick < LAPIC_CALIBRATE_TICKS) {
+		/* wait */
+	}
+	elapsed = 0xFFFFFFFFUL - lapic_timer_read();
+	lapic_timer_stop();
+	s_lapic_count = elapsed / LAPIC_CALIBRATE_TICKS;
+
+	int_install_handler(LAPIC_TIMER_VECTOR, &timer_lapic_int_handler);
+	int_disable();
+	irq_disable(TIMER_IRQ);
+	lapic_timer_start(s_lapic_count, true);
+	int_enable();
+
+	cons_printf("Local APIC timer: %lu counts per tick\n", (ulong_t) s_lapic_count);
+}
+
+/*
+ * Measure the TSC frequency against the timer tick.
+ * Interrupts must be enabled.
+ */
+static void timer_calibrate_tsc(void)
+{
+	u32_t start_tick;
+	u64_t start, elapsed;
+
+	/* start at a tick boundary */
+	start_tick = g_numticks;
+	while (g_numticks == start_tick) {
+		/* wait */
+	}
+	start_tick = g_numticks;
+	start = timer_read_cycles();
+	while (g_numticks - start_tick < TSC_CALIBRATE_TICKS) {
+		/* wait */
+	}
+	elapsed = timer_read_cycles() - start;
+
+	s_ns_mult = timer_div64_32(((u64_t) TSC_CALIBRATE_TICKS * TIMER_NS_PER_TICK) << TSC_NS_SHIFT,
+		(u32_t) elapsed);
+	s_tsc_base = timer_read_cycles();
+	s_ns_base = (u64_t) g_numticks * TIMER_NS_PER_TICK;
+	s_use_tsc = true;
+
+	cons_printf("TSC runs at %lu MHz\n",
+		(ulong_t) timer_div64_32(elapsed, TSC_CALIBRATE_TICKS * (TIMER_NS_PER_TICK / 1000)));
+}
+
+void timer_init(void)
+{
+	struct x86_cpuid_info cpuid_info;
+	bool tickless;
+
+	cons_printf("Initialize timer ...............");
+	timer_program_pit();
 	irq_install_handler(TIMER_IRQ, &timer_int_handler);
 	irq_enable(TIMER_IRQ);
 
 	/* now that we have a timer interrupt handler installed, we can
-	 * enable interrupt handling and preemption */
+	 * enable interrupt handling */
 	int_enable();
-	g_preemption = true;
 	cons_printf(".... [OK]\n");
+
+	if (x86_cpuid(&cpuid_info) && cpuid_info.feature_info_edx.tsc) {
+		timer_calibrate_tsc();
+	}
+
+	/* the periodic tick is no longer needed for calibration */
+	int_disable();
+	tickless = timer_start_tickless();
+	int_enable();
+
+	/* the local APIC timer is cheaper to acknowledge, and per-CPU */
+	if (!tickless && lapic_present()) {
+		timer_start_lapic();
+	}
+
+	/* and preemption */
+	g_preemption = true;
+}
+
+/*
+ * In tickless mode, make the timer interrupt sooner if the next
+ * event (see timer_next_event()) is due before the armed one-shot
+ * interrupt, e.g. because a timer event was just added.
+ * The shortened interval still starts where the armed one did,
+ * so no elapsed time is lost.
+ * Interrupts must be disabled.
+ */
+void timer_rearm(void)
+{
+#ifdef TIMER_TICKLESS
+	u32_t next, count, elapsed, new_count;
+	u8_t status;
+
+	KASSERT(!int_enabled());
+
+	if (!s_tickless) {
+		return;
+	}
+	next = timer_next_event();
+	if (next >= s_oneshot_ticks) {
+		/* the armed interrupt is soon enough */
+		return;
+	}
+
+	ioport_outb(PIT_CMD_REG, PIT_CMD_CHANNEL0_READBACK);
+	status = ioport_inb(PIT_CHANNEL0_REG);
+	count = ioport_inb(PIT_CHANNEL0_REG);
+	count |= ioport_inb(PIT_CHANNEL0_REG) << 8;
+	if (status & PIT_STATUS_OUT) {
+		/* the interrupt is already pending */
+		return;
+	}
+
+	elapsed = s_oneshot_skipped;
+	if (!(status & PIT_STATUS_NULL_COUNT)) {
+		elapsed += s_oneshot_load - count;
+	}
+	new_count = next * PIT_DIVISOR;
+	new_count = (new_count > elapsed) ? new_count - elapsed : 1;
+
+	s_oneshot_ticks = next;
+	s_oneshot_skipped = elapsed;
+	timer_load_oneshot(new_count);
+#endif
+}
+
+/*
+ * Start the tick of an application processor.
+ * Interrupts must be disabled.
+ */
+void timer_init_ap(void)
+{
+	if (s_lapic_count != 0) {
+		lapic_timer_start(s_lapic_count, true);
+	}
+}
+
+/*
+ * Read the processor's cycle counter (TSC).
+ * Used to time short code paths, e.g. in benchmarks.
+ */
+u64_t timer_read_cycles(void)
+{
+	u64_t cycles;
+	__asm__ __volatile__ ("rdtsc" : "=A" (cycles));
+	return cycles;
+}
+
+/*
+ * Convert nanoseconds to ticks, rounding up.
+ */
+u32_t timer_ns_to_ticks(u64_t ns)
+{
+	ns += TIMER_NS_PER_TICK - 1;
+	if ((ns >> 32) >= TIMER_NS_PER_TICK) {
+		/* too many ticks to count */
+		return 0xFFFFFFFFUL;
+	}
+	return timer_div64_32(ns, TIMER_NS_PER_TICK);
+}
+
+/*
+ * Get the number of nanoseconds since the timer was started.
+ * The value never decreases.  Its resolution is a single cycle
+ * if the CPU has a TSC, or a single tick otherwise.
+ */
+u64_t timer_get_ns(void)
+{
+	u64_t cycles;
+
+	if (!s_use_tsc) {
+		return (u64_t) g_numticks * TIMER_NS_PER_TICK;
+	}
+
+	/* split the multiplication so that it can't overflow */
+	cycles = timer_read_cycles() - s_tsc_base;
+	return s_ns_base
+		+ (((u64_t) (u32_t) cycles * s_ns_mult) >> TSC_NS_SHIFT)
+		+ (((u64_t) (u32_t) (cycles >> 32) * s_ns_mult) << (32 - TSC_NS_SHIFT));
 }
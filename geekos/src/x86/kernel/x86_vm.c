@@ -23,6 +23,7 @@
 #include <geekos/string.h>
 #include <geekos/vm.h>
 #include <arch/cpu.h>
+#include <arch/string.h>
 
 #define IS_PT_SPAN_ALIGNED(addr) (((addr) & 0xFFC00000) == (addr))
 
@@ -121,6 +122,11 @@ void vm_init_paging(struct multiboot_info *boot_info)
 	 */
 	x86_set_cr4(x86_get_cr4() | CR4_PSE);
 
+	/*
+	 * Use SSE2 in memcpy()/memset() if available.
+	 */
+	x86_string_init(&cpuid_info);
+
 	/*
 	 * Allocate kernel page directory.
 	 */
@@ -171,3 +177,17 @@ void vm_init_paging(struct multiboot_info *boot_info)
 
 	cons_printf("Paging enabled\n");
 }
+
+/*
+ * Identity-map the 4M region containing given physical address
+ * as uncached memory, so that device registers in it
+ * (e.g., the local APIC and IO APIC) can be accessed.
+ */
+void x86_vm_map_io(ulong_t paddr)
+{
+	ulong_t base = paddr & ~(VM_PT_SPAN - 1);
+
+	if (!s_kernel_pagedir[VM_PAGE_DIR_INDEX(base)].present) {
+		vm_set_pde_4m(s_kernel_pagedir, VM_WRITE|VM_READ|VM_NOCACHE, base, base);
+	}
+}